@@ -0,0 +1,88 @@
+#define _DEFAULT_SOURCE
+#include "customAllocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/wait.h>
+
+/*=============================================================================
+* same size churn: bursts of frees and as many allocations of the same size, over a live
+* population whose freed neighbours would merge and re-split on every burst
+* usage: bench_churn [bursts per run]
+* one key=value line per (api, size, fast bins on/off); every run forks with a fresh config
+=============================================================================*/
+#define DEFAULT_BURSTS 20000
+#define LIVE_BLOCKS 512
+#define BURST 16
+
+typedef struct allocatorApi{
+    const char* name;
+    void* (*allocate)(size_t);
+    void (*release)(void*);
+    void (*stats)(heapStats*);
+} allocatorApi;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void runChurn(const allocatorApi* api, size_t size, bool bins, size_t bursts) {
+    void* slots[LIVE_BLOCKS];
+    size_t picked[BURST];
+    unsigned int seed = 2024;
+    for (size_t i = 0; i < LIVE_BLOCKS; i++) {
+        slots[i] = api->allocate(size);
+    }
+    double start = now();
+    for (size_t b = 0; b < bursts; b++) {
+        //neighbouring slots, so with eager coalescing most frees merge with the one before
+        size_t first = rand_r(&seed) % (LIVE_BLOCKS - BURST);
+        for (size_t i = 0; i < BURST; i++) {
+            picked[i] = first + i;
+            api->release(slots[picked[i]]);
+        }
+        for (size_t i = 0; i < BURST; i++) {
+            slots[picked[i]] = api->allocate(size);
+            *(char*)slots[picked[i]] = (char)i;
+        }
+    }
+    double elapsed = now() - start;
+    heapStats stats;
+    api->stats(&stats);
+    printf("api=%s size=%zu fast_bins=%s bursts=%zu ns_per_op=%.1f free_bytes=%zu footprint=%zu\n",
+           api->name, size, bins ? "on" : "off", bursts, elapsed * 1e9 / (bursts * BURST * 2),
+           stats.freeBytes, stats.footprint);
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    static const size_t sizes[] = {16, 48, 128, 200};
+    size_t bursts = argc > 1 ? (size_t)atol(argv[1]) : DEFAULT_BURSTS;
+    const allocatorApi apis[] = {
+        {"st", customMalloc, customFree, customHeapStats},
+        {"mt", customMTMalloc, customMTFree, customMTHeapStats},
+    };
+    for (size_t a = 0; a < sizeof(apis) / sizeof(apis[0]); a++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            for (int bins = 1; bins >= 0; bins--) {
+                pid_t child = fork();
+                if (child == 0) {
+                    heapConfig config = HEAP_CONFIG_DEFAULT;
+                    config.zoneSize = 64 * 1024;
+                    config.fastBinDepth = bins ? FAST_BIN_DEPTH : 0;
+                    if (customHeapCreateWithConfig(&config) != 0) {
+                        _exit(1);
+                    }
+                    runChurn(&apis[a], sizes[s], bins, bursts);
+                    _exit(0);
+                }
+                waitpid(child, NULL, 0);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,164 @@
+#define _DEFAULT_SOURCE
+#include "customAllocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/*=============================================================================
+* RSS against live bytes for long randomized workloads, custom ST, custom MT and glibc
+* usage: bench_frag [steps]
+* one key=value line per run; every run forks, so no run inherits another's heap.
+* internal metrics are -1 for glibc. nothing in a run may call glibc malloc: the single
+* thread heap trims brk and would cut into glibc's own brk heap
+=============================================================================*/
+#define DEFAULT_STEPS 200000
+#define SHORT_SLOTS 512
+#define LONG_SLOTS 4096
+#define SAMPLE_EVERY 1000
+
+typedef struct workload{
+    const char* name;
+    size_t minSize;
+    size_t maxSize;
+    bool skewed;       //mostly small requests with a long tail up to maxSize
+    int longPercent;   //steps that touch the long lived slots
+    int reallocPercent;
+} workload;
+
+static const workload workloads[] = {
+    {"small_uniform", 8, 128, false, 20, 0},
+    {"mixed_skewed", 8, 8192, true, 20, 10},
+    {"long_lived_mixed", 16, 2048, false, 60, 5},
+    {"realloc_heavy", 8, 1024, false, 30, 40},
+};
+
+typedef struct allocatorApi{
+    const char* name;
+    void* (*allocate)(size_t);
+    void (*release)(void*);
+    void* (*resize)(void*, size_t);
+    void (*stats)(heapStats*);
+    bool zoned;        //needs heapCreate first
+} allocatorApi;
+
+static size_t residentBytes() {
+    char text[128];
+    long size, resident;
+    int fd = open("/proc/self/statm", O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    ssize_t got = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    text[got > 0 ? got : 0] = '\0';
+    if (sscanf(text, "%ld %ld", &size, &resident) != 2) {
+        return 0;
+    }
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static size_t pickSize(const workload* w, unsigned int* seed) {
+    size_t span = w->maxSize - w->minSize + 1;
+    if (w->skewed) {
+        //cubing a uniform fraction piles most requests near minSize
+        double f = (double)rand_r(seed) / RAND_MAX;
+        return w->minSize + (size_t)(f * f * f * (span - 1));
+    }
+    return w->minSize + rand_r(seed) % span;
+}
+
+static void runWorkload(const allocatorApi* api, const workload* w, size_t steps) {
+    void* slots[SHORT_SLOTS + LONG_SLOTS] = {0};
+    size_t sizes[SHORT_SLOTS + LONG_SLOTS] = {0};
+    unsigned int seed = 2024;
+    size_t live = 0, peakRss = 0, steadyRss = 0, steadySamples = 0, steadyLive = 0;
+    for (size_t step = 0; step < steps; step++) {
+        //short lived slots are hit most of the time, so their blocks turn over quickly
+        size_t slot = rand_r(&seed) % 100 < (unsigned int)w->longPercent
+                      ? SHORT_SLOTS + rand_r(&seed) % LONG_SLOTS
+                      : rand_r(&seed) % SHORT_SLOTS;
+        if (slots[slot] == NULL) {
+            sizes[slot] = pickSize(w, &seed);
+            slots[slot] = api->allocate(sizes[slot]);
+            if (slots[slot] != NULL) {
+                memset(slots[slot], (int)slot, sizes[slot]);
+                live += sizes[slot];
+            }
+        }
+        else if (rand_r(&seed) % 100 < (unsigned int)w->reallocPercent) {
+            size_t size = pickSize(w, &seed);
+            void* moved = api->resize(slots[slot], size);
+            if (moved != NULL) {
+                live += size;
+                live -= sizes[slot];
+                slots[slot] = moved;
+                sizes[slot] = size;
+            }
+        }
+        else {
+            api->release(slots[slot]);
+            slots[slot] = NULL;
+            live -= sizes[slot];
+        }
+        if (step % SAMPLE_EVERY == 0) {
+            size_t rss = residentBytes();
+            peakRss = rss > peakRss ? rss : peakRss;
+            if (step >= steps / 2) {
+                steadyRss += rss;
+                steadyLive += live;
+                steadySamples++;
+            }
+        }
+    }
+    steadyRss = steadySamples ? steadyRss / steadySamples : 0;
+    steadyLive = steadySamples ? steadyLive / steadySamples : 0;
+    heapStats stats;
+    long long header = -1, unused = -1, zones = -1, mapped = -1, footprint = -1;
+    if (api->stats != NULL) {
+        api->stats(&stats);
+        header = (long long)stats.headerBytes;
+        unused = (long long)stats.freeBytes;
+        zones = (long long)stats.zones;
+        mapped = (long long)stats.mappedBytes;
+        footprint = (long long)stats.footprint;
+    }
+    printf("api=%s workload=%s steps=%zu live_bytes=%zu steady_live_bytes=%zu peak_rss=%zu steady_rss=%zu "
+           "rss_per_live=%.2f header_bytes=%lld free_bytes=%lld zones=%lld mapped_bytes=%lld footprint=%lld\n",
+           api->name, w->name, steps, live, steadyLive, peakRss, steadyRss,
+           steadyLive ? (double)steadyRss / steadyLive : 0.0, header, unused, zones, mapped, footprint);
+    fflush(stdout);
+    for (size_t i = 0; i < SHORT_SLOTS + LONG_SLOTS; i++) {
+        if (slots[i] != NULL) {
+            api->release(slots[i]);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    static char outBuffer[4096];
+    setvbuf(stdout, outBuffer, _IOFBF, sizeof(outBuffer));
+    size_t steps = argc > 1 ? (size_t)atol(argv[1]) : DEFAULT_STEPS;
+    const allocatorApi apis[] = {
+        {"st", customMalloc, customFree, customRealloc, customHeapStats, false},
+        {"mt", customMTMalloc, customMTFree, customMTRealloc, customMTHeapStats, true},
+        {"glibc", malloc, free, realloc, NULL, false},
+    };
+    for (size_t a = 0; a < sizeof(apis) / sizeof(apis[0]); a++) {
+        for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+            pid_t child = fork();
+            if (child == 0) {
+                if (apis[a].zoned) {
+                    heapCreate();
+                }
+                runWorkload(&apis[a], &workloads[w], steps);
+                _exit(0);
+            }
+            waitpid(child, NULL, 0);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+#define _DEFAULT_SOURCE
+#include "customAllocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+/*=============================================================================
+* random access over a multi-GiB heap, once from brk zones and once in huge page mode
+* usage: bench_hugepage [heap GiB] [accesses in millions]
+=============================================================================*/
+#define LARGE_CHUNK (64 * 1024 * 1024)
+#define SMALL_OBJECTS (1 << 22)
+#define SMALL_SIZE 64
+#define BATCH 4096
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t nextRandom(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+//large objects: random 8 byte read-modify-writes spread over every chunk
+static double runLarge(size_t heapBytes, size_t accesses, hugePageStats* stats) {
+    size_t chunks = heapBytes / LARGE_CHUNK;
+    uint64_t** chunk = malloc(chunks * sizeof(uint64_t*));
+    for (size_t i = 0; i < chunks; i++) {
+        chunk[i] = customMTMalloc(LARGE_CHUNK);
+        if (chunk[i] == NULL) {
+            printf("large allocation %zu failed\n", i);
+            exit(1);
+        }
+        memset(chunk[i], (int)i, LARGE_CHUNK);
+    }
+    customHugePageStats(stats);
+    uint64_t state = 88172645463325252ULL;
+    uint64_t sum = 0;
+    double start = now();
+    for (size_t i = 0; i < accesses; i++) {
+        uint64_t r = nextRandom(&state);
+        uint64_t* word = &chunk[r % chunks][(r >> 20) % (LARGE_CHUNK / sizeof(uint64_t))];
+        sum += *word;
+        *word = sum;
+    }
+    double elapsed = now() - start;
+    for (size_t i = 0; i < chunks; i++) {
+        customMTFree(chunk[i]);
+    }
+    free(chunk);
+    if (sum == 42) {
+        printf("\n");
+    }
+    return elapsed * 1e9 / accesses;
+}
+
+static int compareAddresses(const void* a, const void* b) {
+    uintptr_t left = (uintptr_t)*(void* const*)a;
+    uintptr_t right = (uintptr_t)*(void* const*)b;
+    return (left > right) - (left < right);
+}
+
+//small objects: a pointer chase through a random cycle of 64 byte blocks in the zones
+static double runSmall(size_t accesses) {
+    void** nodes = malloc(SMALL_OBJECTS * sizeof(void*));
+    size_t count = 0;
+    while (count < SMALL_OBJECTS) {
+        size_t got = customMTMallocBatch(SMALL_SIZE, BATCH, nodes + count);
+        if (got == 0) {
+            printf("small allocation failed\n");
+            exit(1);
+        }
+        count += got;
+    }
+    uint64_t state = 2463534242ULL;
+    for (size_t i = count - 1; i > 0; i--) {
+        size_t j = nextRandom(&state) % (i + 1);
+        void* tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+    for (size_t i = 0; i < count; i++) {
+        *(void**)nodes[i] = nodes[(i + 1) % count];
+    }
+    void* curr = nodes[0];
+    double start = now();
+    for (size_t i = 0; i < accesses; i++) {
+        curr = *(void**)curr;
+    }
+    double elapsed = now() - start;
+    if (curr == NULL) {
+        printf("\n");
+    }
+    //back in address order, so every batch frees into a few zones only
+    qsort(nodes, count, sizeof(void*), compareAddresses);
+    for (size_t i = 0; i < count; i += BATCH) {
+        customMTFreeBatch(nodes + i, count - i < BATCH ? count - i : BATCH);
+    }
+    free(nodes);
+    return elapsed * 1e9 / accesses;
+}
+
+static void run(bool huge, size_t heapBytes, size_t accesses) {
+    heapConfig config = HEAP_CONFIG_DEFAULT;
+    config.hugePages = huge;
+    config.zoneSize = 256 * 1024;
+    if (customHeapCreateWithConfig(&config) != 0) {
+        printf("heap create failed\n");
+        exit(1);
+    }
+    hugePageStats stats;
+    double largeNs = runLarge(heapBytes, accesses, &stats);
+    double smallNs = runSmall(accesses);
+    double coverage = stats.residentBytes != 0 ? 100.0 * stats.hugeBytes / stats.residentBytes : 0.0;
+    printf("mode=%s heap_gib=%.1f large_ns_per_access=%.2f small_ns_per_access=%.2f huge_coverage=%.1f%%\n",
+           huge ? "huge" : "base", heapBytes / (1024.0 * 1024 * 1024), largeNs, smallNs, coverage);
+    heapKill();
+}
+
+int main(int argc, char** argv) {
+    double gib = argc > 1 ? atof(argv[1]) : 2.0;
+    size_t accesses = (argc > 2 ? (size_t)atol(argv[2]) : 20) * 1000 * 1000;
+    size_t heapBytes = (size_t)(gib * 1024 * 1024 * 1024);
+    if (heapBytes < LARGE_CHUNK) {
+        heapBytes = LARGE_CHUNK;
+    }
+    run(false, heapBytes, accesses);
+    run(true, heapBytes, accesses);
+    return 0;
+}
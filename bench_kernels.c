@@ -0,0 +1,92 @@
+#define _DEFAULT_SOURCE
+#include "customAllocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+/*=============================================================================
+* copy and zero throughput: the old calloc byte loop, memcpy/memset and every kernel level
+* usage: bench_kernels [MiB moved per run]
+* one key=value line per (op, impl, size); levels the CPU lacks are skipped
+=============================================================================*/
+#define DEFAULT_MIB 512
+#define BUFFER_BYTES (64 * 1024 * 1024)
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//the loop customCalloc and customMTCalloc ran before the kernels; volatile keeps it a loop
+static void zeroByteLoop(void* dst, size_t n) {
+    volatile char* chrptr = dst;
+    for (size_t i = 0; i < n; ++i) {
+        chrptr[i] = 0;
+    }
+}
+
+static void zeroLibc(void* dst, size_t n) {
+    memset(dst, 0, n);
+}
+
+static void copyLibc(void* dst, const void* src, size_t n) {
+    memcpy(dst, src, n);
+}
+
+static const char* levelNames[KERNEL_LEVELS] = {"scalar", "sse2", "avx2"};
+
+//every run walks the buffer, so sizes past the caches really come from memory
+static void report(const char* op, const char* impl, size_t size, size_t total,
+                   void (*zero)(void*, size_t), void (*copy)(void*, const void*, size_t),
+                   char* dst, const char* src) {
+    size_t slots = BUFFER_BYTES / size;
+    size_t rounds = total / size;
+    rounds = rounds ? rounds : 1;
+    double start = now();
+    for (size_t i = 0; i < rounds; i++) {
+        size_t at = (i % slots) * size;
+        if (zero != NULL) {
+            zero(dst + at, size);
+        }
+        else {
+            copy(dst + at, src + at, size);
+        }
+    }
+    double elapsed = now() - start;
+    printf("op=%s impl=%s size=%zu gib_per_s=%.2f ns_per_op=%.1f\n", op, impl, size,
+           (double)size * rounds / elapsed / (1024.0 * 1024 * 1024), elapsed * 1e9 / rounds);
+}
+
+int main(int argc, char** argv) {
+    static const size_t sizes[] = {256, 4096, 65536, 1024 * 1024, KERNEL_STREAM_BYTES, 16 * 1024 * 1024};
+    size_t total = (argc > 1 ? (size_t)atol(argv[1]) : DEFAULT_MIB) * 1024 * 1024;
+    //glibc buffers: this measures the kernels, not the heap
+    char* src = malloc(BUFFER_BYTES + 64);
+    char* dst = malloc(BUFFER_BYTES + 64);
+    if (src == NULL || dst == NULL) {
+        printf("buffer allocation failed\n");
+        return 1;
+    }
+    //odd offsets, like the 4 byte granular payloads of the heap
+    src += 4;
+    dst += 12;
+    memset(src, 0x5a, BUFFER_BYTES);
+    memset(dst, 0x11, BUFFER_BYTES);
+    kernelLevel best = customKernelLevel();
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t size = sizes[s];
+        report("zero", "byte_loop", size, total / 8, zeroByteLoop, NULL, dst, src);
+        report("zero", "memset", size, total, zeroLibc, NULL, dst, src);
+        report("copy", "memcpy", size, total, NULL, copyLibc, dst, src);
+        for (int level = KERNEL_SCALAR; level <= (int)best; level++) {
+            customSetKernelLevel((kernelLevel)level);
+            report("zero", levelNames[level], size, total, blockZero, NULL, dst, src);
+            report("copy", levelNames[level], size, total, NULL, blockCopy, dst, src);
+        }
+        customSetKernelLevel(best);
+    }
+    return 0;
+}
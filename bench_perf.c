@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include "customAllocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/*=============================================================================
+* hardware counters per allocator operation, for every size class and heap population
+* usage: bench_perf [operations per run]
+* counters the kernel refuses (perf_event_paranoid, no PMU in a VM) print as -1, wall time
+* per operation is always there
+=============================================================================*/
+#define COUNTERS 6
+#define DEFAULT_OPS 2000
+
+typedef struct counterSpec{
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+} counterSpec;
+
+static const counterSpec counterSpecs[COUNTERS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"l1d_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"llc_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+static int counterFds[COUNTERS];
+static struct timespec runStart;
+
+static void openCounters() {
+    for (int i = 0; i < COUNTERS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counterSpecs[i].type;
+        attr.config = counterSpecs[i].config;
+        attr.disabled = 1;
+        //user space only, so it works under perf_event_paranoid 2
+        attr.exclude_kernel = counterSpecs[i].type != PERF_TYPE_SOFTWARE;
+        attr.exclude_hv = 1;
+        counterFds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+static void startCounters() {
+    for (int i = 0; i < COUNTERS; i++) {
+        if (counterFds[i] >= 0) {
+            ioctl(counterFds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counterFds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &runStart);
+}
+
+//values[COUNTERS] gets the wall time in ns
+static void stopCounters(int64_t* values) {
+    struct timespec runEnd;
+    clock_gettime(CLOCK_MONOTONIC, &runEnd);
+    values[COUNTERS] = (int64_t)(runEnd.tv_sec - runStart.tv_sec) * 1000000000 + (runEnd.tv_nsec - runStart.tv_nsec);
+    for (int i = 0; i < COUNTERS; i++) {
+        uint64_t value;
+        values[i] = -1;
+        if (counterFds[i] >= 0) {
+            ioctl(counterFds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counterFds[i], &value, sizeof(value)) == sizeof(value)) {
+                values[i] = (int64_t)value;
+            }
+        }
+    }
+}
+
+static void report(const char* api, const char* op, size_t size, size_t population,
+                   const int64_t* values, size_t ops) {
+    printf("api=%s op=%s size=%zu population=%zu ns=%.2f", api, op, size, population,
+           (double)values[COUNTERS] / ops);
+    for (int i = 0; i < COUNTERS; i++) {
+        if (values[i] < 0) {
+            printf(" %s=-1", counterSpecs[i].name);
+        }
+        else {
+            printf(" %s=%.2f", counterSpecs[i].name, (double)values[i] / ops);
+        }
+    }
+    printf("\n");
+}
+
+typedef struct allocatorApi{
+    const char* name;
+    void* (*allocate)(size_t);
+    void (*release)(void*);
+} allocatorApi;
+
+//live blocks of mixed sizes with every other one freed, so lists and zones hold holes
+static void** populate(const allocatorApi* api, size_t population) {
+    void** live = malloc((population + 1) * sizeof(void*));
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < population; i++) {
+        live[i] = api->allocate(rand_r(&seed) % 512 + 8);
+    }
+    for (size_t i = 0; i < population; i += 2) {
+        api->release(live[i]);
+        live[i] = NULL;
+    }
+    return live;
+}
+
+static void depopulate(const allocatorApi* api, void** live, size_t population) {
+    //top down, so the single thread heap can trim as it goes
+    for (size_t i = population; i-- > 0;) {
+        if (live[i] != NULL) {
+            api->release(live[i]);
+        }
+    }
+    free(live);
+}
+
+static void runApi(const allocatorApi* api, size_t ops) {
+    static const size_t sizes[] = {16, 64, 256, 1024, 3000};
+    static const size_t populations[] = {0, 1000, 10000};
+    void** blocks = malloc(ops * sizeof(void*));
+    int64_t values[COUNTERS + 1];
+    for (size_t p = 0; p < sizeof(populations) / sizeof(populations[0]); p++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            void** live = populate(api, populations[p]);
+            startCounters();
+            for (size_t i = 0; i < ops; i++) {
+                blocks[i] = api->allocate(sizes[s]);
+            }
+            stopCounters(values);
+            report(api->name, "malloc", sizes[s], populations[p], values, ops);
+            startCounters();
+            for (size_t i = ops; i-- > 0;) {
+                api->release(blocks[i]);
+            }
+            stopCounters(values);
+            report(api->name, "free", sizes[s], populations[p], values, ops);
+            depopulate(api, live, populations[p]);
+        }
+    }
+    free(blocks);
+}
+
+int main(int argc, char** argv) {
+    size_t ops = argc > 1 ? (size_t)atol(argv[1]) : DEFAULT_OPS;
+    openCounters();
+    //the single thread heap runs first and trims back, brk then belongs to the zones
+    allocatorApi st = {"st", customMalloc, customFree};
+    runApi(&st, ops);
+    heapCreate();
+    allocatorApi mt = {"mt", customMTMalloc, customMTFree};
+    runApi(&mt, ops);
+    heapKill();
+    return 0;
+}
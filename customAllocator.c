@@ -1,693 +1,3397 @@
-#define _DEFAULT_SOURCE
+#define _GNU_SOURCE //sched_getcpu
 #include <unistd.h>
 #include "customAllocator.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86
+#endif
 
 Block* blockList = NULL;
+Block* largeFreeRoot = NULL;
+fastBinSet fastBinsST;
 memZone* zone_list_head;
-int memZoneIndx =0 ;
-pthread_mutex_t memZoneIndxLock;
-pthread_mutex_t num_of_zones_lock;
-int num_of_zones = 8;
+unsigned int memZoneIndx[ALLOC_HINTS] __attribute__((aligned(CACHE_LINE_SIZE)));
+//zones of every lifetime group, the group's oldest zone and the zone it last created or revived,
+//written under num_of_zones_lock
+unsigned int groupZoneCount[ALLOC_HINTS];
+memZone* groupFirstZone[ALLOC_HINTS];
+memZone* groupNewestZone[ALLOC_HINTS];
+pthread_mutex_t num_of_zones_lock __attribute__((aligned(CACHE_LINE_SIZE)));
+int num_of_zones __attribute__((aligned(CACHE_LINE_SIZE))) = 8;
+size_t nextZoneSize = 4 * 1024; //written under num_of_zones_lock
+heapConfig heapConf = HEAP_CONFIG_DEFAULT;
+static bool heapConfLoaded = false;
+bool mtCacheAligned = false;
+bool deferredFreeEnabled = false;
+cpuCache* cpuCaches = NULL;
+int numCpuCaches = 0;
+bool cpuCacheEnabled = false;
+
+/*=============================================================================
+* single threaded fast path
+=============================================================================*/
+//until a second thread calls into the MT API the only caller skips every lock;
+//it flags itself inside an operation, and the second thread waits for that flag to clear
+int mtThreadCount = 0;
+bool mtSingleThreaded = true;
+bool mtOwnerInOp = false;
+static __thread bool mtThreadRegistered = false;
+static __thread bool mtLocksElided = false;
+static __thread int mtOpDepth = 0;
+
+static void watchThreadExit();
+
+static void mtRegisterThread(){
+    mtThreadRegistered = true;
+    watchThreadExit();
+    if (__atomic_add_fetch(&mtThreadCount, 1, __ATOMIC_SEQ_CST) >= 2) {
+        __atomic_store_n(&mtSingleThreaded, false, __ATOMIC_SEQ_CST);
+        //every later thread waits too, the owner may still be inside its last elided operation
+        while (__atomic_load_n(&mtOwnerInOp, __ATOMIC_SEQ_CST)) {
+            sched_yield();
+        }
+    }
+}
 
-memZone* create_new_zone(){
- //   printf("inside CREATE NEW ZONE \n");
-    memZone* curr = zone_list_head;
-    while (curr!=NULL){
-        if (curr->next == NULL){
-         //   printf("before brk");
-            memZone* new_zone = sbrk(sizeof(memZone));
-            if (new_zone == (void*)-1) {
-                printf("<sbrk/brk error>: out of memory\n");
-                exit(1);
-            }
+void mtOpBegin(){
+    if (mtOpDepth++ > 0) {
+        return;
+    }
+    if (!mtThreadRegistered) {
+        mtRegisterThread();
+    }
+    if (__atomic_load_n(&mtSingleThreaded, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&mtOwnerInOp, true, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&mtSingleThreaded, __ATOMIC_SEQ_CST)) {
+            mtLocksElided = true;
+            return;
+        }
+        __atomic_store_n(&mtOwnerInOp, false, __ATOMIC_RELEASE);
+    }
+    mtLocksElided = false;
+}
 
-            new_zone->startOfZone = (char*)sbrk(4096);
-            if (new_zone->startOfZone == SBRK_FAIL) {
-                printf("<sbrk/brk error>: out of memory\n");
-                exit(1);
-            }
+void mtOpEnd(){
+    if (--mtOpDepth > 0) {
+        return;
+    }
+    if (mtLocksElided) {
+        mtLocksElided = false;
+        __atomic_store_n(&mtOwnerInOp, false, __ATOMIC_RELEASE);
+    }
+}
 
-            if (pthread_mutex_init(&(new_zone->zoneLock), NULL) != 0) {
-                perror("Mutex init failed");
-                return NULL;
-            }
-            new_zone->remainingSpace = 4 * 1024;
+bool customMTIsSingleThreaded(){
+    return __atomic_load_n(&mtSingleThreaded, __ATOMIC_ACQUIRE);
+}
 
-            Block* initialBlock = (Block*)new_zone->startOfZone;
-            initialBlock->size =ALIGN_TO_MULT_OF_4( (4 * 1024) - sizeof(Block)); // Payload size
-            initialBlock->free = true;
-            initialBlock->next = NULL;
+static inline void mtLock(pthread_mutex_t* lock){
+    if (!mtLocksElided) {
+        pthread_mutex_lock(lock);
+    }
+}
 
-            new_zone->zoneBlockList = initialBlock;
-            new_zone->next = NULL;
+static inline void mtUnlock(pthread_mutex_t* lock){
+    if (!mtLocksElided) {
+        pthread_mutex_unlock(lock);
+    }
+}
 
-            curr->next = new_zone;
-            return new_zone;
-        }
-        else {
-            curr = curr->next;
-        }
+/*=============================================================================
+* copy and zero kernels
+=============================================================================*/
+//below KERNEL_STREAM_BYTES libc's memcpy and memset are vectorized already and win. the
+//kernels take the big moves: a memcpy or memset head up to the store alignment, then
+//non-temporal stores in 64 or 128 byte steps, then the tail
+static void copyScalar(void* dst, const void* src, size_t n){
+    memcpy(dst, src, n);
+}
+
+static void zeroScalar(void* dst, size_t n){
+    memset(dst, 0, n);
+}
+
+#ifdef KERNELS_X86
+__attribute__((target("sse2")))
+static void copySSE2(void* dst, const void* src, size_t n){
+    char* d = dst;
+    const char* s = src;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)s);
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i*)(s + 48));
+        _mm_stream_si128((__m128i*)d, a);
+        _mm_stream_si128((__m128i*)(d + 16), b);
+        _mm_stream_si128((__m128i*)(d + 32), c);
+        _mm_stream_si128((__m128i*)(d + 48), e);
     }
-    return NULL;
+    _mm_sfence(); //streamed stores are weakly ordered
+    memcpy(d, s, n);
 }
-Block* findBestFit(size_t size) {
-    Block* current = blockList;
-    Block* bestFit = NULL;
 
-    while (current != NULL) {
-        // We only care about free blocks that are large enough
-        if (current->free && current->size >= size) {
+__attribute__((target("sse2")))
+static void zeroSSE2(void* dst, size_t n){
+    char* d = dst;
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    __m128i zero = _mm_setzero_si128();
+    memset(d, 0, head);
+    d += head;
+    n -= head;
+    for (; n >= 64; n -= 64, d += 64) {
+        _mm_stream_si128((__m128i*)d, zero);
+        _mm_stream_si128((__m128i*)(d + 16), zero);
+        _mm_stream_si128((__m128i*)(d + 32), zero);
+        _mm_stream_si128((__m128i*)(d + 48), zero);
+    }
+    _mm_sfence();
+    memset(d, 0, n);
+}
 
-            if (bestFit == NULL || current->size < bestFit->size) {
-                bestFit = current;
+__attribute__((target("avx2")))
+static void copyAVX2(void* dst, const void* src, size_t n){
+    char* d = dst;
+    const char* s = src;
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    for (; n >= 128; n -= 128, d += 128, s += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)s);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(s + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i*)(s + 96));
+        _mm256_stream_si256((__m256i*)d, a);
+        _mm256_stream_si256((__m256i*)(d + 32), b);
+        _mm256_stream_si256((__m256i*)(d + 64), c);
+        _mm256_stream_si256((__m256i*)(d + 96), e);
+    }
+    _mm_sfence();
+    memcpy(d, s, n);
+}
 
+__attribute__((target("avx2")))
+static void zeroAVX2(void* dst, size_t n){
+    char* d = dst;
+    size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+    __m256i zero = _mm256_setzero_si256();
+    memset(d, 0, head);
+    d += head;
+    n -= head;
+    for (; n >= 128; n -= 128, d += 128) {
+        _mm256_stream_si256((__m256i*)d, zero);
+        _mm256_stream_si256((__m256i*)(d + 32), zero);
+        _mm256_stream_si256((__m256i*)(d + 64), zero);
+        _mm256_stream_si256((__m256i*)(d + 96), zero);
+    }
+    _mm_sfence();
+    memset(d, 0, n);
+}
+#else
+#define copySSE2 copyScalar
+#define zeroSSE2 zeroScalar
+#define copyAVX2 copyScalar
+#define zeroAVX2 zeroScalar
+#endif
+
+typedef struct kernelSet{
+    void (*copy)(void* dst, const void* src, size_t n);
+    void (*zero)(void* dst, size_t n);
+} kernelSet;
+
+static const kernelSet kernelSets[KERNEL_LEVELS] = {
+    {copyScalar, zeroScalar},
+    {copySSE2, zeroSSE2},
+    {copyAVX2, zeroAVX2},
+};
+static int kernelLevelInUse = -1; //picked on first use
+
+static kernelLevel bestKernelLevel(){
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return KERNEL_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return KERNEL_SSE2;
+    }
+#endif
+    return KERNEL_SCALAR;
+}
 
-                if (current->size == size) {
-                    return current;
-                }
-            }
-        }
-        current = current->next;
+kernelLevel customKernelLevel(){
+    int level = __atomic_load_n(&kernelLevelInUse, __ATOMIC_RELAXED);
+    if (level < 0) {
+        //racing first callers all store the same level
+        level = bestKernelLevel();
+        __atomic_store_n(&kernelLevelInUse, level, __ATOMIC_RELAXED);
     }
-    return bestFit;
+    return (kernelLevel)level;
+}
+
+int customSetKernelLevel(kernelLevel level){
+    if (level < KERNEL_SCALAR || level >= KERNEL_LEVELS || level > bestKernelLevel()) {
+        return -1;
+    }
+    __atomic_store_n(&kernelLevelInUse, (int)level, __ATOMIC_RELAXED);
+    return 0;
 }
 
+void blockCopy(void* dst, const void* src, size_t n){
+    if (n < KERNEL_STREAM_BYTES) {
+        memcpy(dst, src, n);
+        return;
+    }
+    kernelSets[customKernelLevel()].copy(dst, src, n);
+}
 
+void blockZero(void* dst, size_t n){
+    if (n < KERNEL_STREAM_BYTES) {
+        memset(dst, 0, n);
+        return;
+    }
+    kernelSets[customKernelLevel()].zero(dst, n);
+}
 
+/*=============================================================================
+* memory budget
+=============================================================================*/
+size_t heapFootprint __attribute__((aligned(CACHE_LINE_SIZE))) = 0;
+lowMemoryHandler lowMemoryCallback = NULL;
+
+//false when the bytes would take the heap past its budget
+static bool reserveHeapBytes(size_t bytes){
+    size_t used = __atomic_load_n(&heapFootprint, __ATOMIC_RELAXED);
+    do {
+        if (heapConf.memoryBudget != 0 && used + bytes > heapConf.memoryBudget) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&heapFootprint, &used, used + bytes, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return true;
+}
 
-Block* findBestFitInZoneMT(memZone* zone, size_t size) {
-    Block* current = zone->zoneBlockList;
-    Block* bestFit = NULL;
+static void releaseHeapBytes(size_t bytes){
+    __atomic_sub_fetch(&heapFootprint, bytes, __ATOMIC_RELAXED);
+}
 
-    while (current != NULL) {
+//the last eighth of the budget is only used once caches and free lists were given back
+static bool heapNearBudget(size_t bytes){
+    return heapConf.memoryBudget != 0 &&
+           __atomic_load_n(&heapFootprint, __ATOMIC_RELAXED) + bytes >
+           heapConf.memoryBudget - heapConf.memoryBudget / 8;
+}
 
-        if (current->free && current->size >= size) {
+//one more way to get memory back before an allocation gives up: the allocator's own
+//caches and free lists first, then the application's handler. false once both were tried
+static bool recoverMemory(int* stage, size_t requested, void (*relieve)()){
+    if (*stage == 0) {
+        *stage = 1;
+        relieve();
+        return true;
+    }
+    if (*stage == 1 && lowMemoryCallback != NULL) {
+        *stage = 2;
+        lowMemoryCallback(requested);
+        return true;
+    }
+    return false;
+}
 
+void customSetLowMemoryHandler(lowMemoryHandler handler){
+    lowMemoryCallback = handler;
+}
 
-            if (bestFit == NULL || current->size < bestFit->size) {
-                bestFit = current;
+size_t customHeapFootprint(){
+    return __atomic_load_n(&heapFootprint, __ATOMIC_RELAXED);
+}
 
+//moves brk up to the next cache line before growing, the skipped bytes are simply lost
+void* sbrkAligned(size_t size){
+    char* top = sbrk(0);
+    if (top == SBRK_FAIL) {
+        return SBRK_FAIL;
+    }
+    size_t pad = ALIGN_UP((uintptr_t)top, CACHE_LINE_SIZE) - (uintptr_t)top;
+    if (pad != 0 && sbrk(pad) == SBRK_FAIL) {
+        return SBRK_FAIL;
+    }
+    return sbrk(size);
+}
 
-                if (current->size == size) {
-                    return current;
-                }
-            }
-        }
-        current = current->next;
+//zone memory follows right after its metadata, the whole zone starts as untouched tail.
+//the tail is zeroed: a bump block's header counts as written once its size is non zero
+int initZoneMT(memZone* zone, char* start, size_t size){
+    if (pthread_mutex_init(&(zone->zoneLock), NULL) != 0) {
+        perror("Mutex init failed");
+        return -1;
     }
-    return bestFit;
+    blockZero(start, size);
+    zone->startOfZone = start;
+    zone->endOfZone = start + size;
+    zone->bumpPtr = start;
+    zone->linkedEnd = start;
+    zone->remainingSpace = 0;
+    zone->zoneBlockList = NULL;
+    zone->largeFreeRoot = NULL;
+    zone->largestFree = 0;
+    zone->group = DEFAULT_LIVED;
+    zone->state = ZONE_ACTIVE;
+    memset(&zone->fastBins, 0, sizeof(zone->fastBins));
+    zone->next = NULL;
+    return 0;
 }
 
-Block* requestSpace(Block* last, size_t size) {
-    Block* block;
+/*=============================================================================
+* huge pages
+=============================================================================*/
+hugeRegion* hugeRegions = NULL; //the one zones are carved from first, written under num_of_zones_lock
 
-    // Calculate total size needed: struct metadata + requested payload
-    size_t totalSize = size + sizeof(Block);
+void* mapHugeAligned(size_t length){
+    //over-map by one huge page and cut the unaligned ends off
+    char* raw = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        printf("<mmap error>: out of memory\n");
+        return NULL;
+    }
+    char* aligned = (char*)ALIGN_UP((uintptr_t)raw, HUGE_PAGE_SIZE);
+    if (aligned != raw) {
+        munmap(raw, aligned - raw);
+    }
+    munmap(aligned + length, raw + HUGE_PAGE_SIZE - aligned);
+    madvise(aligned, length, MADV_HUGEPAGE);
+    return aligned;
+}
 
-    block = (Block*)sbrk(totalSize);
+//next cache line aligned piece of the current region, a new region once it is full
+static char* hugeRegionCarve(size_t size){
+    size_t header = ALIGN_UP(sizeof(hugeRegion), CACHE_LINE_SIZE);
+    hugeRegion* region = hugeRegions;
+    if (region == NULL || region->used + size > region->size) {
+        size_t length = ALIGN_UP(header + size, HUGE_PAGE_SIZE);
+        region = mapHugeAligned(length);
+        if (region == NULL) {
+            return NULL;
+        }
+        region->size = length;
+        region->used = header;
+        region->next = hugeRegions;
+        hugeRegions = region;
+    }
+    char* piece = (char*)region + region->used;
+    region->used += ALIGN_UP(size, CACHE_LINE_SIZE);
+    return piece;
+}
 
+static void unmapHugeRegions(){
+    while (hugeRegions != NULL) {
+        hugeRegion* next = hugeRegions->next;
+        munmap(hugeRegions, hugeRegions->size);
+        hugeRegions = next;
+    }
+}
 
-    if (block == SBRK_FAIL) {
+int customHugePageStats(hugePageStats* stats){
+    FILE* smaps = fopen("/proc/self/smaps", "r");
+    if (stats == NULL || smaps == NULL) {
+        if (smaps != NULL) {
+            fclose(smaps);
+        }
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+    char line[512];
+    unsigned long start = 0, end = 0;
+    size_t rss = 0, huge = 0, kb;
+    //VmFlags closes every mapping's entry, "hg" marks MADV_HUGEPAGE
+    while (fgets(line, sizeof(line), smaps) != NULL) {
+        unsigned long from, to;
+        if (sscanf(line, "%lx-%lx ", &from, &to) == 2) {
+            start = from;
+            end = to;
+            rss = huge = 0;
+        }
+        else if (sscanf(line, "Rss: %zu kB", &kb) == 1) {
+            rss = kb * 1024;
+        }
+        else if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            huge = kb * 1024;
+        }
+        else if (strncmp(line, "VmFlags:", 8) == 0 && strstr(line, " hg") != NULL) {
+            stats->reservedBytes += end - start;
+            stats->residentBytes += rss;
+            stats->hugeBytes += huge;
+        }
+    }
+    fclose(smaps);
+    return 0;
+}
+
+//metadata and memory of one zone, from a huge page region or from brk
+static memZone* newZoneMemory(size_t size, char** start){
+    if (heapConf.hugePages) {
+        char* piece = hugeRegionCarve(sizeof(memZone) + size);
+        if (piece == NULL) {
+            return NULL;
+        }
+        *start = piece + sizeof(memZone);
+        return (memZone*)piece;
+    }
+    memZone* zone = sbrkAligned(sizeof(memZone));
+    if (zone == (void*)-1) {
         printf("<sbrk/brk error>: out of memory\n");
-        exit(1);
+        return NULL;
+    }
+    *start = (char*)sbrk(size);
+    if (*start == SBRK_FAIL) {
+        printf("<sbrk/brk error>: out of memory\n");
+        return NULL;
     }
+    return zone;
+}
 
+static void releaseZonePages(char* start, char* end);
 
-    block->size = size;
-    block->next = NULL;
-    block->free = false;
+//caller holds num_of_zones_lock
 
-    if (last) {
-        last->next = block;
+memZone* create_new_zone(allocHint group){
+    memZone* curr = zone_list_head;
+    while (curr!=NULL){
+        if (curr->next == NULL){
+            size_t size = nextZoneSize;
+            if (!reserveHeapBytes(sizeof(memZone) + size)) {
+                return NULL;
+            }
+            char* start;
+            memZone* new_zone = newZoneMemory(size, &start);
+            if (new_zone == NULL) {
+                releaseHeapBytes(sizeof(memZone) + size);
+                return NULL;
+            }
+            if (initZoneMT(new_zone, start, size) != 0) {
+                releaseZonePages(start, start + size); //brk space stays, its pages go back
+                releaseHeapBytes(sizeof(memZone) + size);
+                return NULL;
+            }
+            new_zone->group = group;
+            if (heapConf.growth == ZONE_GROWTH_DOUBLE) {
+                nextZoneSize = size * 2 < heapConf.maxZoneSize ? size * 2 : heapConf.maxZoneSize;
+            }
+            //lock-free readers walk the list, publish the zone only once it is ready
+            __atomic_store_n(&curr->next, new_zone, __ATOMIC_RELEASE);
+            __atomic_store_n(&groupZoneCount[group], groupZoneCount[group] + 1, __ATOMIC_RELAXED);
+            if (groupFirstZone[group] == NULL) {
+                __atomic_store_n(&groupFirstZone[group], new_zone, __ATOMIC_RELEASE);
+            }
+            return new_zone;
+        }
+        else {
+            curr = curr->next;
+        }
     }
+    return NULL;
+}
+/*=============================================================================
+* heap configuration
+=============================================================================*/
+static bool confWordIs(const char* word, size_t len, const char* name){
+    return strlen(name) == len && strncmp(word, name, len) == 0;
+}
 
-    return block;
+//decimal with an optional k/m/g suffix; values that do not fit a size_t are refused
+static bool parseConfSize(const char* value, const char* end, size_t* out){
+    char* parsedEnd;
+    if (*value < '0' || *value > '9') { //strtoull would take a sign and wrap it
+        return false;
+    }
+    errno = 0;
+    unsigned long long parsed = strtoull(value, &parsedEnd, 10);
+    if (parsedEnd == value || errno == ERANGE) {
+        return false;
+    }
+    int shift = 0;
+    switch (*parsedEnd) {
+        case 'k': case 'K': shift = 10; parsedEnd++; break;
+        case 'm': case 'M': shift = 20; parsedEnd++; break;
+        case 'g': case 'G': shift = 30; parsedEnd++; break;
+        default: break;
+    }
+    if (parsedEnd != end || parsed > (unsigned long long)(SIZE_MAX >> shift)) {
+        return false;
+    }
+    *out = (size_t)parsed << shift;
+    return true;
 }
 
+//values past INT_MAX are refused, a cast would cut them down
+static bool confInt(int* field, size_t number){
+    if (number > INT_MAX) {
+        return false;
+    }
+    *field = (int)number;
+    return true;
+}
 
-Block* getBlock(void* ptr) {
-    return (Block*)ptr - 1;
+static bool applyConfEntry(heapConfig* config, const char* key, size_t keyLen,
+                           const char* value, const char* end){
+    size_t number;
+    if (confWordIs(key, keyLen, "growth")) {
+        if (confWordIs(value, end - value, "fixed")) {
+            config->growth = ZONE_GROWTH_FIXED;
+        }
+        else if (confWordIs(value, end - value, "double")) {
+            config->growth = ZONE_GROWTH_DOUBLE;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+    if (!parseConfSize(value, end, &number)) {
+        return false;
+    }
+    if (confWordIs(key, keyLen, "zones")) {
+        return confInt(&config->initialZones, number);
+    }
+    else if (confWordIs(key, keyLen, "zone_size")) {
+        config->zoneSize = number;
+    }
+    else if (confWordIs(key, keyLen, "max_zone_size")) {
+        config->maxZoneSize = number;
+    }
+    else if (confWordIs(key, keyLen, "cache_depth")) {
+        return confInt(&config->cpuCacheDepth, number);
+    }
+    else if (confWordIs(key, keyLen, "fast_bin_depth")) {
+        return confInt(&config->fastBinDepth, number);
+    }
+    else if (confWordIs(key, keyLen, "magazine")) {
+        return confInt(&config->poolMagazineSize, number);
+    }
+    else if (confWordIs(key, keyLen, "trim_threshold")) {
+        config->trimThreshold = number;
+    }
+    else if (confWordIs(key, keyLen, "large_threshold")) {
+        config->largeObjectThreshold = number;
+    }
+    else if (confWordIs(key, keyLen, "budget")) {
+        config->memoryBudget = number;
+    }
+    else if (confWordIs(key, keyLen, "huge_pages")) {
+        config->hugePages = number != 0;
+    }
+    else if (confWordIs(key, keyLen, "check_free_size")) {
+        config->checkFreeSize = number != 0;
+    }
+    else {
+        return false;
+    }
+    return true;
 }
 
+//zoneSize is also checked as customHeapCreateWithConfig rounds it: a size that wraps on the way
+//up to a cache line, or initial zones that do not add up in a size_t, are refused
+static bool heapConfigValid(const heapConfig* config){
+    size_t zoneSize = ALIGN_UP(config->zoneSize, CACHE_LINE_SIZE);
+    size_t zoneBytes;
+    size_t heapBytes;
+    return config->initialZones >= 1 && config->zoneSize >= sizeof(Block) + 4 && zoneSize >= config->zoneSize &&
+           !__builtin_add_overflow(zoneSize, sizeof(memZone), &zoneBytes) &&
+           !__builtin_mul_overflow((size_t)config->initialZones, zoneBytes, &heapBytes) &&
+           config->cpuCacheDepth >= 0 && config->cpuCacheDepth <= CPU_CACHE_DEPTH &&
+           config->fastBinDepth >= 0 && config->fastBinDepth <= FAST_BIN_DEPTH &&
+           config->poolMagazineSize >= 2 && config->poolMagazineSize <= POOL_MAGAZINE_SIZE;
+}
 
-void* customMalloc(size_t size) {
- //   printf("hello mallic\n");
-    if (size == 0) {
-       // printf("???????");
-        return NULL;
+//a bad entry is dropped whole, the entries around it still apply
+int heapConfigFromEnv(heapConfig* config){
+    const char* conf = getenv("CUSTOM_MALLOC_CONF");
+    int result = 0;
+    while (conf != NULL && *conf != '\0') {
+        const char* end = strchr(conf, ',');
+        if (end == NULL) {
+            end = conf + strlen(conf);
+        }
+        const char* colon = memchr(conf, ':', end - conf);
+        heapConfig applied = *config;
+        if (colon == NULL || !applyConfEntry(&applied, conf, colon - conf, colon + 1, end) ||
+            !heapConfigValid(&applied)) {
+            printf("<config error>: bad CUSTOM_MALLOC_CONF entry %.*s\n", (int)(end - conf), conf);
+            result = -1;
+        }
+        else {
+            *config = applied;
+        }
+        conf = *end == ',' ? end + 1 : end;
     }
-    size_t alignedSize = ALIGN_TO_MULT_OF_4(size);
+    return result;
+}
 
-    Block* block;
+//the single thread allocator has no create call, it picks the environment up on first use
+static void loadHeapConf(){
+    heapConfigFromEnv(&heapConf);
+    heapConfLoaded = true;
+}
 
+/*=============================================================================
+* header seals and safe-linking
+=============================================================================*/
+//every header carries a seal of its own address and size keyed with its heap's secret. a
+//pointer into the middle of a block, a block of the other heap or an overwritten header fails
+//it, so free and realloc check a pointer in O(1) instead of walking the block list
+uintptr_t heapSecretST = 0; //drawn with the first single thread block
+uintptr_t heapSecretMT = 0; //drawn again by every heapCreate
+uintptr_t heapSecretMapped = 0; //drawn with the first large block, shared by both heaps
+
+static uintptr_t newHeapSecret() {
+    uintptr_t secret = 0;
+    if (getrandom(&secret, sizeof(secret), GRND_NONBLOCK) != (ssize_t)sizeof(secret)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        secret = ((uintptr_t)ts.tv_nsec * (uintptr_t)0x9E3779B97F4A7C15ULL) ^ (uintptr_t)&secret ^ (uintptr_t)ts.tv_sec;
+    }
+    return secret | 1; //0 means not drawn yet
+}
 
-    if (blockList == NULL) {
-       // printf("inside the if \n");
-        block = requestSpace(NULL, alignedSize);
-      //  printf("requesteed space good\n");
-        if (!block) {
-            return NULL;
-        }
-        blockList = block;
-    } else {
+static inline uint32_t blockSeal(const Block* block, size_t size, uintptr_t secret) {
+    uint64_t mixed = ((uint64_t)(uintptr_t)block ^ secret) + size * 0x9E3779B97F4A7C15ULL;
+    mixed ^= mixed >> 31;
+    mixed *= 0xBF58476D1CE4E5B9ULL;
+    mixed ^= mixed >> 29;
+    return (uint32_t)mixed;
+}
 
-        Block* bestFit = findBestFit(alignedSize);
-       // printf("after bestfit\n");
-        if (bestFit) {
+//after every size change of a header
+static inline void sealBlock(Block* block, uintptr_t secret) {
+    block->seal = blockSeal(block, block->size, secret);
+}
 
-            block = bestFit;
-            block->free = false;
-            size_t remainingSize = bestFit->size - alignedSize;
+static inline bool blockSealed(const Block* block, uintptr_t secret) {
+    return block->seal == blockSeal(block, block->size, secret);
+}
 
-            if (remainingSize >= sizeof(Block) + 4){ //basic size is 4 byte at minimum
-                block->size =   alignedSize;  // sizeof(Block)  ;
+//the bin links live in freed payload, where a write after free can reach them. they are stored
+//mixed with their own address and the secret (safe-linking), so such a write decodes to a
+//pointer that fails the seal instead of one the attacker picked. the same call encodes and decodes
+static inline void* safeLink(void* slot, void* link, uintptr_t secret) {
+    return (void*)(((uintptr_t)slot >> 12) ^ (uintptr_t)link ^ secret);
+}
 
-                //Block* newNode = bestFit + (block->size) /sizeof(Block* )  ; //remainder
-                Block* newBlock = (Block*) ((char*)block + sizeof(Block) + alignedSize);
+/*=============================================================================
+* large objects
+=============================================================================*/
+//every large block is a mapping of its own, the live ones are chained through Block.next and
+//back through a prev link that sits in the mapping right in front of the header
+Block* mappedBlocks = NULL;
+pthread_mutex_t mappedBlocksLock = PTHREAD_MUTEX_INITIALIZER;
+//every mapping ever made lies in [mappedLow, mappedHigh); only grows, written under mappedBlocksLock
+char* mappedLow = NULL;
+char* mappedHigh = NULL;
+
+static inline Block** mappedPrev(Block* block){
+    return (Block**)block - 1;
+}
 
-                newBlock->size = remainingSize - sizeof(Block);
-                newBlock->free = true;
-                newBlock->next = block->next;
-                //newNode->size = bestFit->size - block->size;
-                //newNode->free = true;
-                // newNode-> next = block->next;
-                block->next = newBlock;
-            }
-        } else {
-            Block* last = blockList;
-            while (last->next != NULL) {
-                last = last->next;
-            }
+bool isLargeObject(size_t size){
+    return heapConf.largeObjectThreshold != 0 && size >= heapConf.largeObjectThreshold;
+}
 
-            block = requestSpace(last, alignedSize);
-            if (!block) {
-                return NULL;
-            }
+void* mapLargeBlock(size_t size, size_t alignment){
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    //the prev link and the header sit in front of the aligned payload, inside the first page
+    size_t offset = ALIGN_UP(sizeof(Block*) + sizeof(Block), alignment) - sizeof(Block);
+    size_t length = ALIGN_UP(offset + sizeof(Block) + size, pageSize);
+    bool huge = heapConf.hugePages && length >= HUGE_PAGE_SIZE;
+    if (huge) {
+        length = ALIGN_UP(length, HUGE_PAGE_SIZE);
+    }
+    if (!reserveHeapBytes(length)) {
+        return NULL;
+    }
+    char* base = huge ? mapHugeAligned(length) : mapChunk(length);
+    if (base == NULL) {
+        releaseHeapBytes(length);
+        return NULL;
+    }
+    Block* block = (Block*)(base + offset);
+    block->size = length - offset - sizeof(Block);
+    block->free = false;
+    block->binned = false;
+    block->cached = false;
+    uintptr_t unset = 0;
+    __atomic_compare_exchange_n(&heapSecretMapped, &unset, newHeapSecret(), false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    sealBlock(block, __atomic_load_n(&heapSecretMapped, __ATOMIC_RELAXED));
+    mtLock(&mappedBlocksLock);
+    *mappedPrev(block) = NULL;
+    block->next = mappedBlocks;
+    if (mappedBlocks != NULL) {
+        *mappedPrev(mappedBlocks) = block;
+    }
+    mappedBlocks = block;
+    if (mappedLow == NULL || base < mappedLow) {
+        __atomic_store_n(&mappedLow, base, __ATOMIC_RELAXED);
+    }
+    if (base + length > mappedHigh) {
+        __atomic_store_n(&mappedHigh, base + length, __ATOMIC_RELAXED);
+    }
+    mtUnlock(&mappedBlocksLock);
+    return (void*)(block + 1);
+}
+
+//every heap free that misses its own heap asks next, so a header without the mapped seal answers
+//without the lock. the header is only read for a pointer inside the mapped span whose header
+//and prev link share its page, as every mapped one does: a foreign pointer the caller can read
+//never makes it fault on the page in front
+static bool mappedSealed(void* ptr){
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return __atomic_load_n(&mappedBlocks, __ATOMIC_RELAXED) != NULL &&
+           (char*)ptr >= __atomic_load_n(&mappedLow, __ATOMIC_RELAXED) &&
+           (char*)ptr < __atomic_load_n(&mappedHigh, __ATOMIC_RELAXED) &&
+           ((uintptr_t)ptr & (pageSize - 1)) >= sizeof(Block*) + sizeof(Block) &&
+           blockSealed(getBlock(ptr), __atomic_load_n(&heapSecretMapped, __ATOMIC_RELAXED));
+}
+
+//caller holds mappedBlocksLock; a sealed header is on the list when its neighbour points back
+static bool mappedLinked(Block* block){
+    Block* prev = *mappedPrev(block);
+    return prev == NULL ? mappedBlocks == block : prev->next == block;
+}
+
+bool isMappedBlock(void* ptr){
+    if (!mappedSealed(ptr)) {
+        return false;
+    }
+    mtLock(&mappedBlocksLock);
+    bool linked = mappedLinked(getBlock(ptr));
+    mtUnlock(&mappedBlocksLock);
+    return linked;
+}
+
+//false when ptr is not a mapped block
+bool unmapLargeBlock(void* ptr){
+    if (!mappedSealed(ptr)) {
+        return false;
+    }
+    Block* block = getBlock(ptr);
+    mtLock(&mappedBlocksLock);
+    if (!mappedLinked(block)) {
+        mtUnlock(&mappedBlocksLock);
+        return false;
+    }
+    Block* prev = *mappedPrev(block);
+    if (prev == NULL) {
+        mappedBlocks = block->next;
+    }
+    else {
+        prev->next = block->next;
+    }
+    if (block->next != NULL) {
+        *mappedPrev(block->next) = prev;
+    }
+    mtUnlock(&mappedBlocksLock);
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    char* base = (char*)((uintptr_t)block & ~(uintptr_t)(pageSize - 1));
+    size_t length = (char*)(block + 1) + block->size - base;
+    munmap(base, length);
+    releaseHeapBytes(length);
+    return true;
+}
+
+//a mapped block never grows in place, a bigger one is allocated the usual way
+static void* reallocLargeBlock(void* ptr, size_t size, void* (*allocate)(size_t), void (*release)(void*)){
+    Block* header = getBlock(ptr);
+    if (size <= header->size) {
+        return ptr;
+    }
+    void* newPtr = allocate(size);
+    if (newPtr == NULL) {
+        return NULL;
+    }
+    blockCopy(newPtr, ptr, header->size);
+    release(ptr);
+    return newPtr;
+}
+
+/*=============================================================================
+* large free block index
+=============================================================================*/
+//red-black tree keyed by (size, address), the node lives in the free block's payload
+#define LEFT(b) (FREE_NODE(b)->left)
+#define RIGHT(b) (FREE_NODE(b)->right)
+#define PARENT(b) (FREE_NODE(b)->parent)
+#define IS_RED(b) ((b) != NULL && FREE_NODE(b)->red)
+
+static bool freeKeyLess(Block* a, Block* b) {
+    return a->size < b->size || (a->size == b->size && a < b);
+}
+
+static void rotateLeft(Block** root, Block* x) {
+    Block* y = RIGHT(x);
+    RIGHT(x) = LEFT(y);
+    if (LEFT(y) != NULL) {
+        PARENT(LEFT(y)) = x;
+    }
+    PARENT(y) = PARENT(x);
+    if (PARENT(x) == NULL) {
+        *root = y;
+    }
+    else if (x == LEFT(PARENT(x))) {
+        LEFT(PARENT(x)) = y;
+    }
+    else {
+        RIGHT(PARENT(x)) = y;
+    }
+    LEFT(y) = x;
+    PARENT(x) = y;
+}
+
+static void rotateRight(Block** root, Block* x) {
+    Block* y = LEFT(x);
+    LEFT(x) = RIGHT(y);
+    if (RIGHT(y) != NULL) {
+        PARENT(RIGHT(y)) = x;
+    }
+    PARENT(y) = PARENT(x);
+    if (PARENT(x) == NULL) {
+        *root = y;
+    }
+    else if (x == RIGHT(PARENT(x))) {
+        RIGHT(PARENT(x)) = y;
+    }
+    else {
+        LEFT(PARENT(x)) = y;
+    }
+    RIGHT(y) = x;
+    PARENT(x) = y;
+}
+
+static void freeIndexInsert(Block** root, Block* z) {
+    Block* y = NULL;
+    Block* x = *root;
+    while (x != NULL) {
+        y = x;
+        x = freeKeyLess(z, x) ? LEFT(x) : RIGHT(x);
+    }
+    PARENT(z) = y;
+    LEFT(z) = NULL;
+    RIGHT(z) = NULL;
+    FREE_NODE(z)->red = true;
+    if (y == NULL) {
+        *root = z;
+    }
+    else if (freeKeyLess(z, y)) {
+        LEFT(y) = z;
+    }
+    else {
+        RIGHT(y) = z;
+    }
+
+    while (IS_RED(PARENT(z))) {
+        Block* p = PARENT(z);
+        Block* g = PARENT(p);
+        if (p == LEFT(g)) {
+            Block* u = RIGHT(g);
+            if (IS_RED(u)) {
+                FREE_NODE(p)->red = false;
+                FREE_NODE(u)->red = false;
+                FREE_NODE(g)->red = true;
+                z = g;
+            }
+            else {
+                if (z == RIGHT(p)) {
+                    z = p;
+                    rotateLeft(root, z);
+                    p = PARENT(z);
+                }
+                FREE_NODE(p)->red = false;
+                FREE_NODE(g)->red = true;
+                rotateRight(root, g);
+            }
+        }
+        else {
+            Block* u = LEFT(g);
+            if (IS_RED(u)) {
+                FREE_NODE(p)->red = false;
+                FREE_NODE(u)->red = false;
+                FREE_NODE(g)->red = true;
+                z = g;
+            }
+            else {
+                if (z == LEFT(p)) {
+                    z = p;
+                    rotateRight(root, z);
+                    p = PARENT(z);
+                }
+                FREE_NODE(p)->red = false;
+                FREE_NODE(g)->red = true;
+                rotateLeft(root, g);
+            }
+        }
+    }
+    FREE_NODE(*root)->red = false;
+}
+
+static void transplant(Block** root, Block* u, Block* v) {
+    if (PARENT(u) == NULL) {
+        *root = v;
+    }
+    else if (u == LEFT(PARENT(u))) {
+        LEFT(PARENT(u)) = v;
+    }
+    else {
+        RIGHT(PARENT(u)) = v;
+    }
+    if (v != NULL) {
+        PARENT(v) = PARENT(u);
+    }
+}
+
+static void freeIndexRemove(Block** root, Block* z) {
+    Block* y = z;
+    bool removedRed = FREE_NODE(y)->red;
+    Block* x;
+    Block* xParent;
+    if (LEFT(z) == NULL) {
+        x = RIGHT(z);
+        xParent = PARENT(z);
+        transplant(root, z, RIGHT(z));
+    }
+    else if (RIGHT(z) == NULL) {
+        x = LEFT(z);
+        xParent = PARENT(z);
+        transplant(root, z, LEFT(z));
+    }
+    else {
+        y = RIGHT(z);
+        while (LEFT(y) != NULL) {
+            y = LEFT(y);
+        }
+        removedRed = FREE_NODE(y)->red;
+        x = RIGHT(y);
+        if (PARENT(y) == z) {
+            xParent = y;
+        }
+        else {
+            xParent = PARENT(y);
+            transplant(root, y, RIGHT(y));
+            RIGHT(y) = RIGHT(z);
+            PARENT(RIGHT(y)) = y;
+        }
+        transplant(root, z, y);
+        LEFT(y) = LEFT(z);
+        PARENT(LEFT(y)) = y;
+        FREE_NODE(y)->red = FREE_NODE(z)->red;
+    }
+    if (removedRed) {
+        return;
+    }
+
+    while (x != *root && !IS_RED(x)) {
+        if (x == LEFT(xParent)) {
+            Block* w = RIGHT(xParent);
+            if (IS_RED(w)) {
+                FREE_NODE(w)->red = false;
+                FREE_NODE(xParent)->red = true;
+                rotateLeft(root, xParent);
+                w = RIGHT(xParent);
+            }
+            if (!IS_RED(LEFT(w)) && !IS_RED(RIGHT(w))) {
+                FREE_NODE(w)->red = true;
+                x = xParent;
+                xParent = PARENT(x);
+            }
+            else {
+                if (!IS_RED(RIGHT(w))) {
+                    FREE_NODE(LEFT(w))->red = false;
+                    FREE_NODE(w)->red = true;
+                    rotateRight(root, w);
+                    w = RIGHT(xParent);
+                }
+                FREE_NODE(w)->red = FREE_NODE(xParent)->red;
+                FREE_NODE(xParent)->red = false;
+                if (RIGHT(w) != NULL) {
+                    FREE_NODE(RIGHT(w))->red = false;
+                }
+                rotateLeft(root, xParent);
+                x = *root;
+            }
+        }
+        else {
+            Block* w = LEFT(xParent);
+            if (IS_RED(w)) {
+                FREE_NODE(w)->red = false;
+                FREE_NODE(xParent)->red = true;
+                rotateRight(root, xParent);
+                w = LEFT(xParent);
+            }
+            if (!IS_RED(LEFT(w)) && !IS_RED(RIGHT(w))) {
+                FREE_NODE(w)->red = true;
+                x = xParent;
+                xParent = PARENT(x);
+            }
+            else {
+                if (!IS_RED(LEFT(w))) {
+                    FREE_NODE(RIGHT(w))->red = false;
+                    FREE_NODE(w)->red = true;
+                    rotateLeft(root, w);
+                    w = LEFT(xParent);
+                }
+                FREE_NODE(w)->red = FREE_NODE(xParent)->red;
+                FREE_NODE(xParent)->red = false;
+                if (LEFT(w) != NULL) {
+                    FREE_NODE(LEFT(w))->red = false;
+                }
+                rotateRight(root, xParent);
+                x = *root;
+            }
+        }
+    }
+    if (x != NULL) {
+        FREE_NODE(x)->red = false;
+    }
+}
+
+//a free block is in the index exactly when it is large, so call these before its size changes
+void freeIndexInsertIfLarge(Block** root, Block* block) {
+    if (block->size >= LARGE_BLOCK_THRESHOLD) {
+        freeIndexInsert(root, block);
+    }
+}
+
+void freeIndexRemoveIfLarge(Block** root, Block* block) {
+    if (block->size >= LARGE_BLOCK_THRESHOLD) {
+        freeIndexRemove(root, block);
+    }
+}
+
+//smallest block that fits, lowest address among equal sizes
+Block* freeIndexBestFit(Block* root, size_t size) {
+    Block* best = NULL;
+    while (root != NULL) {
+        if (root->size >= size) {
+            best = root;
+            root = LEFT(root);
+        }
+        else {
+            root = RIGHT(root);
+        }
+    }
+    return best;
+}
+
+//caller holds zone->zoneLock; publishes the largest free block in the zone list for lock-free readers
+void updateZoneSummaryMT(memZone* zone) {
+    size_t largest = 0;
+    if (zone->largeFreeRoot != NULL) {
+        Block* node = zone->largeFreeRoot;
+        while (RIGHT(node) != NULL) {
+            node = RIGHT(node);
+        }
+        largest = node->size;
+    }
+    else {
+        for (Block* curr = zone->zoneBlockList; curr != NULL; curr = curr->next) {
+            if (curr->free && curr->size > largest) {
+                largest = curr->size;
+            }
+        }
+    }
+    __atomic_store_n(&zone->largestFree, largest, __ATOMIC_RELAXED);
+}
+
+Block* findBestFit(size_t size) {
+    if (size >= LARGE_BLOCK_THRESHOLD) {
+        return freeIndexBestFit(largeFreeRoot, size);
+    }
+    Block* current = blockList;
+    Block* bestFit = NULL;
+
+    while (current != NULL) {
+        // We only care about free blocks that are large enough
+        if (current->free && current->size >= size) {
+
+            if (bestFit == NULL || current->size < bestFit->size) {
+                bestFit = current;
+
+
+                if (current->size == size) {
+                    return current;
+                }
+            }
+        }
+        current = current->next;
+    }
+    return bestFit;
+}
+
+
+
+
+Block* findBestFitInZoneMT(memZone* zone, size_t size) {
+    if (size >= LARGE_BLOCK_THRESHOLD) {
+        return freeIndexBestFit(zone->largeFreeRoot, size);
+    }
+    Block* current = zone->zoneBlockList;
+    Block* bestFit = NULL;
+
+    while (current != NULL) {
+
+        if (current->free && current->size >= size) {
+
+
+            if (bestFit == NULL || current->size < bestFit->size) {
+                bestFit = current;
+
+
+                if (current->size == size) {
+                    return current;
+                }
+            }
+        }
+        current = current->next;
+    }
+    return bestFit;
+}
+
+Block* requestSpace(Block* last, size_t size) {
+    Block* block;
+
+    // Calculate total size needed: struct metadata + requested payload
+    size_t totalSize = size + sizeof(Block);
+    if (!reserveHeapBytes(totalSize)) {
+        return NULL;
+    }
+
+    block = (Block*)sbrk(totalSize);
+
+
+    if (block == SBRK_FAIL) {
+        printf("<sbrk/brk error>: out of memory\n");
+        releaseHeapBytes(totalSize);
+        return NULL;
+    }
+
+
+    if (heapSecretST == 0) {
+        heapSecretST = newHeapSecret();
+    }
+    block->size = size;
+    block->next = NULL;
+    block->free = false;
+    block->binned = false;
+    block->cached = false;
+    sealBlock(block, heapSecretST);
+
+    if (last) {
+        last->next = block;
+    }
+
+    return block;
+}
+
+
+Block* getBlock(void* ptr) {
+    return (Block*)ptr - 1;
+}
+
+//inside the single thread heap and sealed by it; the list starts at its lowest block
+static bool blockOwnedST(Block* block) {
+    return blockList != NULL && block >= blockList && (char*)(block + 1) <= (char*)sbrk(0) &&
+           blockSealed(block, heapSecretST);
+}
+
+/*=============================================================================
+* fast bins
+=============================================================================*/
+//same size alloc/free ping-pong would merge and re-split the same neighbours on every call;
+//binned blocks skip both until their heap or zone is consolidated. -1 for sizes without a bin
+static int fastBinOf(size_t size) {
+    return size >= FAST_BIN_MIN && size <= FAST_BIN_MAX ? (int)((size - FAST_BIN_MIN) / 4) : -1;
+}
+
+//a decoded link has to land on a binned, sealed header inside [lo, hi) before it is followed
+static bool fastBinLinkOk(void* ptr, uintptr_t secret, const char* lo, const char* hi) {
+    return (const char*)ptr >= lo + sizeof(Block) && (const char*)ptr < hi &&
+           getBlock(ptr)->binned && blockSealed(getBlock(ptr), secret);
+}
+
+//a corrupted bin is dropped whole, its blocks are lost to the heap rather than handed out
+static void fastBinDrop(fastBinSet* set, int bin) {
+    printf("<heap error>: fast bin corrupted\n");
+    set->bins[bin] = NULL;
+    set->counts[bin] = 0;
+    __atomic_store_n(&set->mask, set->mask & ~(1u << bin), __ATOMIC_RELAXED);
+}
+
+static void* fastBinPop(fastBinSet* set, int bin, uintptr_t secret, const char* lo, const char* hi) {
+    void* ptr = set->bins[bin];
+    if (ptr == NULL) {
+        return NULL;
+    }
+    void* next = safeLink(ptr, *(void**)ptr, secret);
+    if (next != NULL && !fastBinLinkOk(next, secret, lo, hi)) {
+        fastBinDrop(set, bin);
+        return NULL;
+    }
+    set->bins[bin] = next;
+    getBlock(ptr)->binned = false;
+    if (--set->counts[bin] == 0) {
+        __atomic_store_n(&set->mask, set->mask & ~(1u << bin), __ATOMIC_RELAXED);
+    }
+    return ptr;
+}
+
+//true once the bin holds more than heapConf.fastBinDepth blocks and wants consolidating
+static bool fastBinPush(fastBinSet* set, int bin, void* ptr, uintptr_t secret) {
+    getBlock(ptr)->binned = true;
+    *(void**)ptr = safeLink(ptr, set->bins[bin], secret);
+    set->bins[bin] = ptr;
+    __atomic_store_n(&set->mask, set->mask | (1u << bin), __ATOMIC_RELAXED);
+    return ++set->counts[bin] > heapConf.fastBinDepth;
+}
+
+//marks every binned block free again and empties the bins, the caller merges the blocks;
+//returns the bytes handed back, headers included
+static size_t fastBinsRelease(fastBinSet* set, uintptr_t secret, const char* lo, const char* hi) {
+    size_t bytes = 0;
+    for (int bin = 0; set->mask != 0 && bin < FAST_BINS; bin++) {
+        void* ptr = set->bins[bin];
+        while (ptr != NULL) {
+            Block* block = getBlock(ptr);
+            ptr = safeLink(ptr, *(void**)ptr, secret);
+            if (ptr != NULL && !fastBinLinkOk(ptr, secret, lo, hi)) {
+                printf("<heap error>: fast bin corrupted\n");
+                ptr = NULL;
+            }
+            block->binned = false;
+            block->free = true;
+            bytes += block->size + sizeof(Block);
+        }
+        set->bins[bin] = NULL;
+        set->counts[bin] = 0;
+    }
+    __atomic_store_n(&set->mask, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&set->unmerged, false, __ATOMIC_RELAXED);
+    return bytes;
+}
+
+//zones and per-CPU caches come from brk as well, so blocks next to each other on the single
+//thread list are not always next to each other in memory
+static bool blocksAdjacent(Block* block, Block* next) {
+    return (char*)(block + 1) + block->size == (char*)next;
+}
+
+//the heap top may only be given back while nothing else was taken from brk above it
+static bool endsAtBreak(Block* block) {
+    return (char*)(block + 1) + block->size == (char*)sbrk(0);
+}
+
+//merges every run of neighbouring free blocks in the list and rebuilds its large free index
+static void coalesceBlockList(Block* list, Block** root, uintptr_t secret) {
+    *root = NULL;
+    for (Block* curr = list; curr != NULL; curr = curr->next) {
+        if (curr->free) {
+            while (curr->next != NULL && curr->next->free && blocksAdjacent(curr, curr->next)) {
+                curr->size += curr->next->size + sizeof(Block);
+                curr->next = curr->next->next;
+                sealBlock(curr, secret);
+            }
+            freeIndexInsertIfLarge(root, curr);
+        }
+    }
+}
+
+static void consolidateST() {
+    fastBinsRelease(&fastBinsST, heapSecretST, (char*)blockList, (char*)sbrk(0));
+    coalesceBlockList(blockList, &largeFreeRoot, heapSecretST);
+}
+
+
+static void relieveMemoryPressureST();
+static void* mallocOnceST(size_t alignedSize);
+
+void* customMalloc(size_t size) {
+ //   printf("hello mallic\n");
+    if (size == 0) {
+       // printf("???????");
+        return NULL;
+    }
+    size_t alignedSize = ALIGN_TO_MULT_OF_4(size);
+    void* ptr = mallocOnceST(alignedSize);
+    int stage = 0;
+    while (ptr == NULL && recoverMemory(&stage, alignedSize, relieveMemoryPressureST)) {
+        ptr = mallocOnceST(alignedSize);
+    }
+    return ptr;
+}
+
+static void* mallocOnceST(size_t alignedSize) {
+    if (!heapConfLoaded) {
+        loadHeapConf();
+    }
+    if (isLargeObject(alignedSize)) {
+        return mapLargeBlock(alignedSize, 4);
+    }
+
+    Block* block;
+
+
+    if (blockList == NULL) {
+       // printf("inside the if \n");
+        block = requestSpace(NULL, alignedSize);
+      //  printf("requesteed space good\n");
+        if (!block) {
+            return NULL;
+        }
+        blockList = block;
+    } else {
+        int bin = fastBinOf(alignedSize);
+        if (bin >= 0 && fastBinsST.bins[bin] != NULL) {
+            void* ptr = fastBinPop(&fastBinsST, bin, heapSecretST, (char*)blockList, (char*)sbrk(0));
+            if (ptr != NULL) {
+                return ptr;
+            }
+        }
+        //a miss: the bins merge back first, so best fit sees every free byte
+        if (fastBinsST.mask != 0) {
+            consolidateST();
+        }
+        Block* bestFit = findBestFit(alignedSize);
+        //frees merge forward only; the backward merges they skipped may be what fits
+        if (bestFit == NULL && fastBinsST.unmerged) {
+            consolidateST();
+            bestFit = findBestFit(alignedSize);
+        }
+       // printf("after bestfit\n");
+        if (bestFit) {
+
+            block = bestFit;
+            freeIndexRemoveIfLarge(&largeFreeRoot, block);
+            block->free = false;
+            size_t remainingSize = bestFit->size - alignedSize;
+
+            if (remainingSize >= sizeof(Block) + 4){ //basic size is 4 byte at minimum
+                block->size =   alignedSize;  // sizeof(Block)  ;
+
+                //Block* newNode = bestFit + (block->size) /sizeof(Block* )  ; //remainder
+                Block* newBlock = (Block*) ((char*)block + sizeof(Block) + alignedSize);
+
+                newBlock->size = remainingSize - sizeof(Block);
+                newBlock->free = true;
+                newBlock->binned = false;
+                newBlock->cached = false;
+                newBlock->next = block->next;
+                sealBlock(block, heapSecretST);
+                sealBlock(newBlock, heapSecretST);
+                //newNode->size = bestFit->size - block->size;
+                //newNode->free = true;
+                // newNode-> next = block->next;
+                block->next = newBlock;
+                freeIndexInsertIfLarge(&largeFreeRoot, newBlock);
+            }
+        } else {
+            Block* last = blockList;
+            while (last->next != NULL) {
+                last = last->next;
+            }
+
+            block = requestSpace(last, alignedSize);
+            if (!block) {
+                return NULL;
+            }
+        }
+    }
+    return (void*)(block + 1);
+}
+Block* getAndValidateBlockReturnPrev(void* ptr) {
+    if (ptr == NULL) {
+        return NULL;
+    }
+    Block* candidateBlock = (Block*)ptr - 1;
+  //  printf("inside getandval\n");
+
+    Block* prev = blockList;
+ //   printf("got prev\n");
+    while (prev->next != NULL) {
+ //       printf("inside prev->next\n");
+        if (prev->next == candidateBlock) {
+    //       printf("found candidate\n");
+            return prev;
+        }
+        prev = prev->next;
+    }
+  //  printf("we end\n");
+    return NULL;
+}
+void customFree(void* ptr){
+    if (ptr == NULL){
+        printf("<free error>: passed null pointer\n");
+        return;
+    }
+    Block* block = getBlock(ptr);
+    if (!blockOwnedST(block)) {
+        if (!unmapLargeBlock(ptr)) {
+            printf("<free error>: passed non-heap pointer\n");
+        }
+        return;
+    }
+    if (block->free || block->binned) {
+        printf("<free error>: double free\n");
+        return;
+    }
+    int bin = fastBinOf(block->size);
+    if (bin >= 0 && block->next != NULL && heapConf.fastBinDepth > 0) {
+        if (fastBinPush(&fastBinsST, bin, ptr, heapSecretST)) {
+            consolidateST();
+        }
+        return;
+    }
+    //only the heap top looks for its predecessor, trimming has to unlink it; the bins merge
+    //first so the whole free run below it goes back
+    Block* prev = NULL;
+    if (block->next == NULL) {
+        if (fastBinsST.mask != 0 || fastBinsST.unmerged) {
+            consolidateST();
+        }
+        prev = blockList != block ? getAndValidateBlockReturnPrev(ptr) : NULL;
+    }
+    block->free = true;
+    //check next
+    if (block->next != NULL && block->next->free && blocksAdjacent(block, block->next)) {
+        freeIndexRemoveIfLarge(&largeFreeRoot, block->next);
+        block->size += block->next->size + sizeof(Block);
+        block->next = block->next->next;
+        sealBlock(block, heapSecretST);
+    }
+    //check prev
+    if (prev != NULL && prev->free && blocksAdjacent(prev, block)) {
+        freeIndexRemoveIfLarge(&largeFreeRoot, prev);
+        prev->size += block->size + sizeof(Block);
+        prev->next = block->next;
+        sealBlock(prev, heapSecretST);
+        block = prev;
+    }
+    else if (block->next != NULL && block != blockList) {
+        fastBinsST.unmerged = true; //consolidation merges it with a free predecessor
+    }
+
+    // now if it is the last block, we can free it and decrease brk
+    if (block->next == NULL && block->size + sizeof(Block) >= heapConf.trimThreshold && endsAtBreak(block)) {
+        Block* newLast = prev;
+        if (block == prev) { //prev's own predecessor becomes the last block
+            newLast = (prev == blockList) ? NULL : getAndValidateBlockReturnPrev(prev + 1);
+        }
+        char* top = sbrk(0);
+        if (brk(block) != BRK_FAIL) {
+            releaseHeapBytes(top - (char*)block);
+            if (newLast == NULL) {
+                blockList = NULL;
+            }
+            else {
+                newLast->next = NULL;
+            }
+            return;
+        }
+        printf("<sbrk/brk error>: could not trim the heap\n"); //the block stays as a free block
+    }
+    freeIndexInsertIfLarge(&largeFreeRoot, block);
+}
+
+//gives a free block at the heap top back even below heapConf.trimThreshold
+static void trimHeapTop(){
+    if (blockList == NULL) {
+        return;
+    }
+    Block* newLast = NULL;
+    Block* last = blockList;
+    while (last->next != NULL) {
+        newLast = last;
+        last = last->next;
+    }
+    if (!last->free || !endsAtBreak(last)) {
+        return;
+    }
+    char* top = sbrk(0);
+    if (brk(last) == BRK_FAIL) {
+        return;
+    }
+    freeIndexRemoveIfLarge(&largeFreeRoot, last);
+    releaseHeapBytes(top - (char*)last);
+    if (newLast == NULL) {
+        blockList = NULL;
+    }
+    else {
+        newLast->next = NULL;
+    }
+}
+
+static void relieveMemoryPressureST(){
+    consolidateST();
+    trimHeapTop();
+}
+//only with heapConf.checkFreeSize, and only on a header the heap owns: a foreign pointer is
+//left to the free to report. the header may be bigger than asked for: class/cache line
+//rounding and split slack
+static bool sizedFreeMatches(void* ptr, size_t size, bool (*owns)(void*)){
+    if (!heapConf.checkFreeSize || !owns(ptr)) {
+        return true;
+    }
+    size_t alignedSize = ALIGN_TO_MULT_OF_4(size);
+    size_t blockSize = getBlock(ptr)->size;
+    if (blockSize < alignedSize ||
+        (blockSize >= alignedSize + CACHE_LINE_SIZE + sizeof(Block) + 4 && !isMappedBlock(ptr))) {
+        printf("<free error>: size does not match block\n");
+        return false;
+    }
+    return true;
+}
+
+static bool ownedST(void* ptr){
+    return blockOwnedST(getBlock(ptr)) || isMappedBlock(ptr);
+}
+
+//the whole payload belongs to the caller, split slack and alignment padding included
+size_t customMallocUsableSize(void* ptr){
+    if (ptr == NULL) {
+        return 0;
+    }
+    return getBlock(ptr)->size;
+}
+
+size_t customMTMallocUsableSize(void* ptr){
+    return customMallocUsableSize(ptr);
+}
+
+void* customMTMallocAtLeast(size_t size, size_t* actual){
+    void* ptr = customMTMalloc(size);
+    if (actual != NULL) {
+        *actual = customMTMallocUsableSize(ptr);
+    }
+    return ptr;
+}
+
+void customFreeSized(void* ptr, size_t size){
+    //the size saves no lookup here, customFree checks the header in O(1) either way
+    if (ptr != NULL && !sizedFreeMatches(ptr, size, ownedST)) {
+        return;
+    }
+    customFree(ptr);
+}
+void* customCalloc(size_t nmemb, size_t size){
+    void* startptr = customMalloc(size*nmemb);
+    if (startptr != NULL) {
+        blockZero(startptr, size*nmemb);
+    }
+    return startptr;
+}
+
+void* customRealloc(void* ptr, size_t size){
+    size = ALIGN_TO_MULT_OF_4(size);
+    if (ptr==NULL){
+        return (void*)customMalloc(size);
+    }
+    if (isMappedBlock(ptr)) {
+        return reallocLargeBlock(ptr, size, customMalloc, customFree);
+    }
+    Block* header = (Block*)ptr - 1;
+    if (!blockOwnedST(header) || header->free || header->binned) {
+        printf("<realloc error>: passed non-heap pointer\n");
+        return NULL;
+    }
+    size_t old_size = header->size;
+    if (size == old_size) { //already fits exactly, split slack included
+        return ptr;
+    }
+    if (size>=old_size){
+        Block* newBlock = customMalloc(size);
+        if (newBlock == NULL) {
+            return NULL;
+        }
+        blockCopy(newBlock,ptr,old_size);
+        customFree(ptr);
+        return (void*)newBlock;
+    }
+    if (size<old_size){
+        char* end_ptr_mem =(char*)ptr+size ;
+        size_t sizeToFree = old_size - size ;
+       // char start_ptr_to_free = old_size - size ;
+        Block* curr = header;
+        Block* BlocktoFree =(Block*)end_ptr_mem;
+        if (sizeToFree>sizeof(Block)){
+         //   printf("@@@@@@\n");
+            BlocktoFree->free=false; //customFree takes it as a block of its own
+            BlocktoFree->binned=false;
+            BlocktoFree->cached=false;
+            BlocktoFree->size= sizeToFree - sizeof(Block);
+            BlocktoFree->next= curr->next;
+            sealBlock(BlocktoFree, heapSecretST);
+            curr->next=(Block*)end_ptr_mem;
+            curr->size=size;
+            curr->free=false;
+            sealBlock(curr, heapSecretST);
+            customFree((void*)((Block*)end_ptr_mem + 1));
+            return (void*)(curr+1) ;
+        }
+        else{
+            //too little slack to split off, the block keeps it
+            return ptr;
+        }
+    }
+   // printf("DEBUG BAD IN REALLOC");
+    return NULL;
+}
+
+// Payload address inside a free block once pushed up to the alignment; a gap in front
+// of it has to be big enough to stay behind as a free block of its own.
+static char* alignedPayloadIn(Block* block, size_t alignment) {
+    char* payload = (char*)ALIGN_UP((uintptr_t)(block + 1), alignment);
+    while (payload != (char*)(block + 1) && (size_t)(payload - (char*)(block + 1)) < sizeof(Block) + 4) {
+        payload += alignment;
+    }
+    return payload;
+}
+
+Block* carveBlockInZoneMT(memZone* zone, size_t size, size_t alignment) {
+    Block* block;
+    if (alignment <= 4) {
+        block = findBestFitInZoneMT(zone, size);
+        if (block == NULL) {
+            return NULL;
+        }
+        freeIndexRemoveIfLarge(&zone->largeFreeRoot, block);
+    }
+    else {
+        Block* current = zone->zoneBlockList;
+        Block* bestFit = NULL;
+        char* bestPayload = NULL;
+        while (current != NULL) {
+            if (current->free) {
+                char* payload = alignedPayloadIn(current, alignment);
+                if (payload + size <= (char*)(current + 1) + current->size &&
+                    (bestFit == NULL || current->size < bestFit->size)) {
+                    bestFit = current;
+                    bestPayload = payload;
+                }
+            }
+            current = current->next;
+        }
+        if (bestFit == NULL) {
+            return NULL;
+        }
+        block = bestFit;
+        freeIndexRemoveIfLarge(&zone->largeFreeRoot, bestFit);
+        if (bestPayload != (char*)(bestFit + 1)) { //leave the leading gap as a free block
+            block = (Block*)bestPayload - 1;
+            block->size = (char*)(bestFit + 1) + bestFit->size - bestPayload;
+            block->next = bestFit->next;
+            bestFit->size = (char*)block - (char*)(bestFit + 1);
+            bestFit->next = block;
+            sealBlock(bestFit, heapSecretMT);
+            freeIndexInsertIfLarge(&zone->largeFreeRoot, bestFit);
+        }
+    }
+
+    block->free = false;
+    block->binned = false;
+    block->cached = false;
+    size_t remainingSize = block->size - size;
+    if (remainingSize >= sizeof(Block) + 4) {
+        block->size = size;
+        Block *newBlock = (Block *) ((char *) block + sizeof(Block) + size);
+
+        newBlock->size = remainingSize - sizeof(Block);
+        newBlock->free = true;
+        newBlock->binned = false;
+        newBlock->cached = false;
+        newBlock->next = block->next;
+        sealBlock(newBlock, heapSecretMT);
+        block->next = newBlock;
+        freeIndexInsertIfLarge(&zone->largeFreeRoot, newBlock);
+    }
+    sealBlock(block, heapSecretMT);
+    zone->remainingSpace -= (block->size + sizeof(Block));
+    updateZoneSummaryMT(zone);
+    return block;
+}
+
+/*=============================================================================
+* zone tail bump allocation
+=============================================================================*/
+//size is stored last, a reader that sees it non zero sees the whole header
+static void publishTailBlock(Block* block, size_t size, bool free) {
+    block->next = NULL;
+    block->free = free;
+    block->binned = false;
+    block->cached = false;
+    block->seal = blockSeal(block, size, heapSecretMT);
+    __atomic_store_n(&block->size, size, __ATOMIC_RELEASE);
+}
+
+//lock-free, claims the block from the zone's untouched tail; NULL when the tail is too small
+static Block* bumpAllocInZoneMT(memZone* zone, size_t size, size_t alignment) {
+    if (size == 0) {
+        size = 4; //a zero size header would look unwritten
+    }
+    char* old = __atomic_load_n(&zone->bumpPtr, __ATOMIC_RELAXED);
+    char* payload;
+    do {
+        payload = alignment > 4 ? alignedPayloadIn((Block*)old, alignment) : old + sizeof(Block);
+        if (payload + size > zone->endOfZone) {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&zone->bumpPtr, &old, payload + size, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    if (payload != old + sizeof(Block)) { //alignment gap stays behind as a free block
+        publishTailBlock((Block*)old, payload - old - 2 * sizeof(Block), true);
+    }
+    Block* block = (Block*)payload - 1;
+    publishTailBlock(block, size, false);
+    return block;
+}
+
+//lock-free, claims up to count neighbouring blocks with a single compare and swap
+static size_t bumpAllocManyInZoneMT(memZone* zone, size_t size, void** out, size_t count) {
+    if (size == 0) {
+        size = 4;
+    }
+    size_t stride = sizeof(Block) + size;
+    char* old = __atomic_load_n(&zone->bumpPtr, __ATOMIC_RELAXED);
+    size_t taken;
+    do {
+        taken = (size_t)(zone->endOfZone - old) / stride;
+        if (taken > count) {
+            taken = count;
+        }
+        if (taken == 0) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&zone->bumpPtr, &old, old + taken * stride, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    for (size_t i = 0; i < taken; i++) {
+        Block* block = (Block*)(old + i * stride);
+        publishTailBlock(block, size, false);
+        out[i] = (void*)(block + 1);
+    }
+    return taken;
+}
+
+//caller holds zone->zoneLock; links every block bumped so far onto the end of the zone list
+void adoptZoneTailMT(memZone* zone) {
+    char* bump = __atomic_load_n(&zone->bumpPtr, __ATOMIC_ACQUIRE);
+    if (zone->linkedEnd == bump) {
+        return;
+    }
+    Block* last = zone->zoneBlockList;
+    while (last != NULL && last->next != NULL) {
+        last = last->next;
+    }
+    char* curr = zone->linkedEnd;
+    while (curr < bump) {
+        Block* block = (Block*)curr;
+        size_t size;
+        while ((size = __atomic_load_n(&block->size, __ATOMIC_ACQUIRE)) == 0) {
+            sched_yield(); //claimed, header not written yet
+        }
+        if (last != NULL) {
+            last->next = block;
+        }
+        else {
+            zone->zoneBlockList = block;
+        }
+        if (block->free) {
+            zone->remainingSpace += size + sizeof(Block);
+            freeIndexInsertIfLarge(&zone->largeFreeRoot, block);
+        }
+        last = block;
+        curr += sizeof(Block) + size;
+    }
+    zone->linkedEnd = bump;
+    updateZoneSummaryMT(zone);
+}
+
+//free block payload a zone needs to fit the request
+static size_t neededInZoneMT(size_t alignedSize, size_t alignment) {
+    //worst case the payload has to move a whole alignment step into the free block
+    return alignment > 4 ? alignedSize + alignment + sizeof(Block) : alignedSize;
+}
+
+static memZone* nextZoneInGroupMT(memZone* zone, allocHint group) {
+    do {
+        zone = zone->next != NULL ? zone->next : zone_list_head;
+    } while (zone->group != group);
+    return zone;
+}
+
+//round robin start, so threads spread over the group's zones. long lived blocks
+//always start at the oldest zone so they pack densely. NULL while the group has no zone
+static memZone* pickStartZoneMT(allocHint group) {
+    memZone* chosen = __atomic_load_n(&groupFirstZone[group], __ATOMIC_ACQUIRE);
+    if (chosen == NULL || group == LONG_LIVED) {
+        return chosen;
+    }
+    unsigned int localIndx = __atomic_fetch_add(&memZoneIndx[group], 1, __ATOMIC_RELAXED) %
+                             __atomic_load_n(&groupZoneCount[group], __ATOMIC_RELAXED);
+    for (unsigned int i = 0; i < localIndx; i++) {
+        chosen = nextZoneInGroupMT(chosen, group);
+    }
+    return chosen;
+}
+
+static Block* tryZoneHolesMT(memZone* zone, size_t alignedSize, size_t alignment, size_t needed) {
+    if (__atomic_load_n(&zone->largestFree, __ATOMIC_RELAXED) < needed) {
+        return NULL;
+    }
+    mtLock(&zone->zoneLock);
+    Block* block = carveBlockInZoneMT(zone, alignedSize, alignment);
+    mtUnlock(&zone->zoneLock);
+    return block;
+}
+
+//the biggest zone growth can still produce
+static size_t zoneCapacityMT() {
+    return heapConf.growth == ZONE_GROWTH_DOUBLE ? heapConf.maxZoneSize : heapConf.zoneSize;
+}
+
+static memZone* reviveZoneMT(allocHint group, size_t alignedSize, size_t alignment);
+static Block* fastBinPopMT(memZone* zone, size_t alignedSize, size_t alignment);
+static Block* consolidateAndCarveMT(memZone* zone, size_t alignedSize, size_t alignment);
+
+//near the budget it gives up instead of growing, unless the pressure was relieved already
+static void* mallocInZonesOnceMT(size_t alignedSize, size_t alignment, allocHint group, bool relieved) {
+    size_t needed = neededInZoneMT(alignedSize, alignment);
+    if (isLargeObject(alignedSize) || needed + sizeof(Block) > zoneCapacityMT()) {
+        if (!relieved && heapNearBudget(alignedSize)) {
+            return NULL;
+        }
+        return mapLargeBlock(alignedSize, alignment);
+    }
+    //short and long lived blocks refill freed holes before they touch fresh tail
+    bool holesFirst = group == SHORT_LIVED || group == LONG_LIVED;
+    memZone* newestSeen = __atomic_load_n(&groupNewestZone[group], __ATOMIC_ACQUIRE);
+    memZone* chosen = pickStartZoneMT(group);
+    //fresh tail without a lock, free blocks only in zones whose published largest free block fits.
+    //draining zones only get a turn once no active zone had room, so they can empty out
+    bool sawDraining = false;
+    for (int round = 0; round < 2 && chosen != NULL; round++) {
+        memZone* zone = chosen;
+        do {
+            zoneState state = __atomic_load_n(&zone->state, __ATOMIC_RELAXED);
+            sawDraining = sawDraining || state == ZONE_DRAINING;
+            if ((state == ZONE_ACTIVE) == (round == 0)) {
+                Block* block = fastBinPopMT(zone, alignedSize, alignment);
+                if (block == NULL && holesFirst) {
+                    block = tryZoneHolesMT(zone, alignedSize, alignment, needed);
+                }
+                if (block == NULL) {
+                    block = bumpAllocInZoneMT(zone, alignedSize, alignment);
+                }
+                if (block == NULL && !holesFirst) {
+                    block = tryZoneHolesMT(zone, alignedSize, alignment, needed);
+                }
+                if (block == NULL) {
+                    block = consolidateAndCarveMT(zone, alignedSize, alignment);
+                }
+                if (block != NULL) {
+                    return (void*)(block + 1);
+                }
+            }
+            zone = nextZoneInGroupMT(zone, group);
+        } while (zone != chosen);
+        if (!sawDraining) {
+            break;
+        }
+    }
+
+    //no zone can take it, bring a retired zone back or grow
+    if (!relieved && heapNearBudget(sizeof(memZone) + nextZoneSize)) {
+        return NULL;
+    }
+    mtLock(&num_of_zones_lock);
+    //threads that missed together queue up here; the ones behind the first take its zone
+    memZone* newest = groupNewestZone[group];
+    if (newest != newestSeen && newest != NULL) {
+        Block* block = bumpAllocInZoneMT(newest, alignedSize, alignment);
+        if (block != NULL) {
+            mtUnlock(&num_of_zones_lock);
+            return (void*)(block + 1);
+        }
+    }
+    memZone* new_zone = reviveZoneMT(group, alignedSize, alignment);
+    if (new_zone == NULL) {
+        new_zone = create_new_zone(group);
+        if (new_zone == NULL) {
+            mtUnlock(&num_of_zones_lock);
+            return NULL;
+        }
+        __atomic_store_n(&num_of_zones, num_of_zones + 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&groupNewestZone[group], new_zone, __ATOMIC_RELEASE);
+    mtUnlock(&num_of_zones_lock);
+
+    Block* block = bumpAllocInZoneMT(new_zone, alignedSize, alignment);
+    return block != NULL ? (void*)(block + 1) : NULL;
+}
+
+static void relieveMemoryPressureMT();
+
+static void* mallocInZonesMT(size_t alignedSize, size_t alignment, allocHint group) {
+    void* ptr = mallocInZonesOnceMT(alignedSize, alignment, group, false);
+    int stage = 0;
+    while (ptr == NULL && recoverMemory(&stage, alignedSize, relieveMemoryPressureMT)) {
+        ptr = mallocInZonesOnceMT(alignedSize, alignment, group, true);
+    }
+    return ptr;
+}
+
+memZone* findZoneMT(void* ptr) {
+    memZone* curr = zone_list_head;
+    while (curr != NULL) {
+        if ((char*)curr->startOfZone <= (char*)ptr && (char*)ptr < curr->endOfZone) {
+            return curr;
+        }
+        curr = curr->next;
+    }
+    return NULL;
+}
+
+//linked or bumped in the zone and sealed by the heap
+static bool blockOwnedMT(memZone* zone, Block* block) {
+    return (char*)block >= zone->startOfZone &&
+           (char*)(block + 1) <= __atomic_load_n(&zone->bumpPtr, __ATOMIC_ACQUIRE) &&
+           blockSealed(block, heapSecretMT);
+}
+
+/*=============================================================================
+* per-CPU caches
+=============================================================================*/
+//cached blocks stay allocated in their zone, the first word of the payload links the bin
+static cpuCache* currentCpuCache() {
+    int cpu = sched_getcpu();
+    if (cpu < 0) {
+        cpu = 0;
+    }
+    return &cpuCaches[cpu % numCpuCaches];
+}
+
+static void* cpuCachePop(int cls) {
+    cpuCache* cache = currentCpuCache();
+    mtLock(&cache->lock);
+    void* ptr = cache->bins[cls];
+    if (ptr != NULL) {
+        void* next = safeLink(ptr, *(void**)ptr, heapSecretMT);
+        if (next != NULL && !(getBlock(next)->cached && blockSealed(getBlock(next), heapSecretMT))) {
+            printf("<heap error>: per-CPU cache corrupted\n");
+            next = NULL; //the rest of the bin is lost rather than handed out
+        }
+        cache->bins[cls] = next;
+        cache->counts[cls] = next != NULL ? cache->counts[cls] - 1 : 0;
+        getBlock(ptr)->cached = false;
+    }
+    mtUnlock(&cache->lock);
+    return ptr;
+}
+
+static bool cpuCachePushClass(void* ptr, int cls);
+
+static bool cpuCachePush(void* ptr) {
+    Block* block = getBlock(ptr);
+    size_t size = block->size;
+    if (block->cached) {
+        printf("<free error>: double free\n");
+        return true;
+    }
+    //top class blocks may carry split slack, anything bigger is not ours
+    if (block->free || block->binned || size < CPU_CACHE_CLASS_STEP ||
+        size >= CPU_CACHE_CLASSES * CPU_CACHE_CLASS_STEP + sizeof(Block) + 4) {
+        return false;
+    }
+    int cls = (int)(size / CPU_CACHE_CLASS_STEP) - 1;
+    if (cls >= CPU_CACHE_CLASSES) {
+        cls = CPU_CACHE_CLASSES - 1;
+    }
+    return cpuCachePushClass(ptr, cls);
+}
+
+static bool cpuCachePushClass(void* ptr, int cls) {
+    cpuCache* cache = currentCpuCache();
+    mtLock(&cache->lock);
+    if (cache->counts[cls] >= heapConf.cpuCacheDepth) {
+        mtUnlock(&cache->lock);
+        return false;
+    }
+    getBlock(ptr)->cached = true;
+    *(void**)ptr = safeLink(ptr, cache->bins[cls], heapSecretMT);
+    cache->bins[cls] = ptr;
+    cache->counts[cls]++;
+    mtUnlock(&cache->lock);
+    return true;
+}
+
+static void freeInZonesMT(void* ptr);
+static bool deferredFreePush(void* ptr);
+static void* mtMallocImpl(size_t size);
+static void mtFreeSizedImpl(void* ptr, size_t size);
+static size_t mtMallocBatchImpl(size_t size, size_t count, void** out);
+static void mtFreeBatchImpl(void** ptrs, size_t count);
+static void* mtReallocImpl(void* ptr, size_t size);
+static void mtEnablePerCPUCacheImpl(bool enable);
+
+//returns every cached block to its zone
+static void cpuCacheFlush() {
+    for (int cpu = 0; cpu < numCpuCaches; cpu++) {
+        mtLock(&cpuCaches[cpu].lock);
+        for (int cls = 0; cls < CPU_CACHE_CLASSES; cls++) {
+            void* ptr = cpuCaches[cpu].bins[cls];
+            while (ptr != NULL) {
+                void* next = safeLink(ptr, *(void**)ptr, heapSecretMT);
+                if (next != NULL && !(getBlock(next)->cached && blockSealed(getBlock(next), heapSecretMT))) {
+                    printf("<heap error>: per-CPU cache corrupted\n");
+                    next = NULL;
+                }
+                getBlock(ptr)->cached = false;
+                freeInZonesMT(ptr);
+                ptr = next;
+            }
+            cpuCaches[cpu].bins[cls] = NULL;
+            cpuCaches[cpu].counts[cls] = 0;
+        }
+        mtUnlock(&cpuCaches[cpu].lock);
+    }
+}
+
+//the flush frees into the zones, so this thread has to count as a heap user like any other
+void customMTEnablePerCPUCache(bool enable) {
+    mtOpBegin();
+    mtEnablePerCPUCacheImpl(enable);
+    mtOpEnd();
+}
+
+static void mtEnablePerCPUCacheImpl(bool enable) {
+    if (enable && cpuCaches == NULL) {
+        long cpus = sysconf(_SC_NPROCESSORS_CONF);
+        if (cpus < 1) {
+            cpus = 1;
+        }
+        cpuCaches = sbrkAligned(cpus * sizeof(cpuCache));
+        if (cpuCaches == SBRK_FAIL) {
+            printf("<sbrk/brk error>: out of memory\n");
+            cpuCaches = NULL;
+            return;
+        }
+        for (int cpu = 0; cpu < cpus; cpu++) {
+            if (pthread_mutex_init(&cpuCaches[cpu].lock, NULL) != 0) {
+                perror("Mutex init failed");
+                cpuCaches = NULL;
+                return;
+            }
+            memset(cpuCaches[cpu].bins, 0, sizeof(cpuCaches[cpu].bins));
+            memset(cpuCaches[cpu].counts, 0, sizeof(cpuCaches[cpu].counts));
+        }
+        numCpuCaches = (int)cpus;
+    }
+    //turned off before the flush, so frees stop feeding the bins it empties
+    bool wasEnabled = __atomic_exchange_n(&cpuCacheEnabled, enable && cpuCaches != NULL, __ATOMIC_ACQ_REL);
+    if (!enable && wasEnabled) {
+        cpuCacheFlush();
+    }
+}
+
+static int cpuCacheClassOf(size_t alignedSize) {
+    return alignedSize == 0 ? 0 : (int)((alignedSize - 1) / CPU_CACHE_CLASS_STEP);
+}
+
+void* customMTMalloc(size_t size) {
+    mtOpBegin();
+    void* ptr = mtMallocImpl(size);
+    mtOpEnd();
+    return ptr;
+}
+
+static void* mtMallocImpl(size_t size) {
+    if (__atomic_load_n(&mtCacheAligned, __ATOMIC_RELAXED)) {
+        return customMTMallocCacheAligned(size);
+    }
+    size_t alignedSize = ALIGN_TO_MULT_OF_4(size);
+    if (__atomic_load_n(&cpuCacheEnabled, __ATOMIC_ACQUIRE) && alignedSize <= CPU_CACHE_CLASSES * CPU_CACHE_CLASS_STEP) {
+        int cls = cpuCacheClassOf(alignedSize);
+        void* ptr = cpuCachePop(cls);
+        if (ptr != NULL) {
+            return ptr;
+        }
+        //round up to the class size so the block comes back to this bin when freed
+        alignedSize = (cls + 1) * CPU_CACHE_CLASS_STEP;
+    }
+    return mallocInZonesMT(alignedSize, 4, DEFAULT_LIVED);
+}
+
+void* customMTMallocCacheAligned(size_t size) {
+    size_t alignedSize = ALIGN_UP(size, CACHE_LINE_SIZE);
+    if (alignedSize == 0) {
+        alignedSize = CACHE_LINE_SIZE;
+    }
+    mtOpBegin();
+    void* ptr = mallocInZonesMT(alignedSize, CACHE_LINE_SIZE, DEFAULT_LIVED);
+    mtOpEnd();
+    return ptr;
+}
+
+void customMTSetCacheAligned(bool enable) {
+    __atomic_store_n(&mtCacheAligned, enable, __ATOMIC_RELAXED);
+}
+
+void* customMTMallocHint(size_t size, allocHint hint) {
+    if (hint == DEFAULT_LIVED) {
+        return customMTMalloc(size);
+    }
+    if (hint < DEFAULT_LIVED || hint >= ALLOC_HINTS) {
+        printf("<malloc error>: unknown lifetime hint\n");
+        return NULL;
+    }
+    mtOpBegin();
+    void* ptr = mallocInZonesMT(ALIGN_TO_MULT_OF_4(size), 4, hint);
+    mtOpEnd();
+    return ptr;
+}
+
+//per-CPU caches feed customMTMalloc, they only take blocks of default zones
+static bool cpuCacheTakesMT(void* ptr) {
+    memZone* zone = findZoneMT(ptr);
+    return zone != NULL && zone->group == DEFAULT_LIVED && blockOwnedMT(zone, getBlock(ptr));
+}
+static bool ownedMT(void* ptr){
+    memZone* zone = findZoneMT(ptr);
+    return zone != NULL ? blockOwnedMT(zone, getBlock(ptr)) : isMappedBlock(ptr);
+}
+
+void customMTFree(void* ptr){
+    if (__atomic_load_n(&deferredFreeEnabled, __ATOMIC_RELAXED) && ptr != NULL && deferredFreePush(ptr)) {
+        return;
+    }
+    mtOpBegin();
+    if (!(__atomic_load_n(&cpuCacheEnabled, __ATOMIC_ACQUIRE) && ptr != NULL && cpuCacheTakesMT(ptr) && cpuCachePush(ptr))) {
+        freeInZonesMT(ptr);
+    }
+    mtOpEnd();
+}
+void customMTFreeSized(void* ptr, size_t size){
+    mtOpBegin();
+    mtFreeSizedImpl(ptr, size);
+    mtOpEnd();
+}
+
+static void mtFreeSizedImpl(void* ptr, size_t size){
+    if (ptr == NULL) {
+        customMTFree(ptr);
+        return;
+    }
+    if (!sizedFreeMatches(ptr, size, ownedMT)) {
+        return;
+    }
+    //the size picks the bin directly. the zone has to take cached blocks at all, like in
+    //customMTFree, and the header is only read once it holds it: sealed, live and a full
+    //class, blocks from before the cache was on may be exact fit
+    size_t alignedSize = ALIGN_TO_MULT_OF_4(size);
+    if (__atomic_load_n(&cpuCacheEnabled, __ATOMIC_ACQUIRE) && alignedSize <= CPU_CACHE_CLASSES * CPU_CACHE_CLASS_STEP) {
+        int cls = cpuCacheClassOf(alignedSize);
+        Block* block = getBlock(ptr);
+        if (cpuCacheTakesMT(ptr) && !block->free && !block->binned && !block->cached &&
+            block->size >= (size_t)(cls + 1) * CPU_CACHE_CLASS_STEP && cpuCachePushClass(ptr, cls)) {
+            return;
+        }
+    }
+    freeInZonesMT(ptr);
+}
+//caller holds zone->zoneLock; prev is NULL when block heads the zone list or was not looked
+//up, the merge with a free predecessor then waits for the next consolidation
+void releaseBlockInZoneMT(memZone* zone, Block* prev, Block* block){
+    zone->remainingSpace += block->size + sizeof(Block);
+    block->free = true;
+    //check next
+    if (block->next != NULL && block->next->free) {
+        freeIndexRemoveIfLarge(&zone->largeFreeRoot, block->next);
+        block->size += block->next->size + sizeof(Block);
+        block->next = block->next->next;
+        sealBlock(block, heapSecretMT);
+    }
+    //check prev
+    if (prev != NULL && prev->free) {
+        freeIndexRemoveIfLarge(&zone->largeFreeRoot, prev);
+        prev->size += block->size + sizeof(Block);
+        prev->next = block->next;
+        sealBlock(prev, heapSecretMT);
+        block = prev;
+    }
+    else if (prev == NULL && block != zone->zoneBlockList) {
+        __atomic_store_n(&zone->fastBins.unmerged, true, __ATOMIC_RELAXED);
+    }
+    freeIndexInsertIfLarge(&zone->largeFreeRoot, block);
+    updateZoneSummaryMT(zone);
+}
+
+//caller holds zone->zoneLock, consolidates the fast bins, merges every run of neighbouring
+//free blocks and rebuilds the index
+void coalesceZoneMT(memZone* zone){
+    zone->remainingSpace += fastBinsRelease(&zone->fastBins, heapSecretMT, zone->startOfZone, zone->linkedEnd);
+    coalesceBlockList(zone->zoneBlockList, &zone->largeFreeRoot, heapSecretMT);
+    updateZoneSummaryMT(zone);
+}
+
+//lock-free look at the bin first, so zones without a block of the size cost no lock
+static Block* fastBinPopMT(memZone* zone, size_t alignedSize, size_t alignment) {
+    int bin = fastBinOf(alignedSize);
+    if (bin < 0 || alignment > 4 || !(__atomic_load_n(&zone->fastBins.mask, __ATOMIC_RELAXED) & (1u << bin))) {
+        return NULL;
+    }
+    mtLock(&zone->zoneLock);
+    void* ptr = fastBinPop(&zone->fastBins, bin, heapSecretMT, zone->startOfZone, zone->linkedEnd);
+    mtUnlock(&zone->zoneLock);
+    return ptr != NULL ? getBlock(ptr) : NULL;
+}
+
+//a miss in the zone: its bins and deferred backward merges might make a block big enough
+static Block* consolidateAndCarveMT(memZone* zone, size_t alignedSize, size_t alignment) {
+    if (__atomic_load_n(&zone->fastBins.mask, __ATOMIC_RELAXED) == 0 &&
+        !__atomic_load_n(&zone->fastBins.unmerged, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    mtLock(&zone->zoneLock);
+    adoptZoneTailMT(zone);
+    coalesceZoneMT(zone);
+    Block* block = carveBlockInZoneMT(zone, alignedSize, alignment);
+    mtUnlock(&zone->zoneLock);
+    return block;
+}
+
+static void freeInZonesMT(void* ptr){
+    memZone* curr = findZoneMT(ptr);
+    if (curr == NULL) {
+        if (ptr != NULL && !unmapLargeBlock(ptr)) {
+            printf("<free error>: passed non-heap pointer\n");
+        }
+        return;
+    }
+    mtLock(&curr->zoneLock);
+    adoptZoneTailMT(curr);
+    Block* candidateBlock = (Block*)ptr - 1;
+    if (!blockOwnedMT(curr, candidateBlock)) {
+        printf("<free error>: passed non-heap pointer\n");
+        mtUnlock(&curr->zoneLock);
+        return;
+    }
+    if (candidateBlock->free || candidateBlock->binned || candidateBlock->cached) {
+        printf("<free error>: double free\n");
+        mtUnlock(&curr->zoneLock);
+        return;
+    }
+    int bin = fastBinOf(candidateBlock->size);
+    if (bin >= 0 && heapConf.fastBinDepth > 0) {
+        if (fastBinPush(&curr->fastBins, bin, ptr, heapSecretMT)) {
+            coalesceZoneMT(curr);
+        }
+    }
+    else {
+        releaseBlockInZoneMT(curr, NULL, candidateBlock);
+    }
+    mtUnlock(&curr->zoneLock);
+}
+
+//hands every per-CPU cached block back and merges the free runs of every zone
+static void relieveMemoryPressureMT(){
+    cpuCacheFlush();
+    for (memZone* zone = zone_list_head; zone != NULL; zone = zone->next) {
+        mtLock(&zone->zoneLock);
+        adoptZoneTailMT(zone);
+        coalesceZoneMT(zone);
+        mtUnlock(&zone->zoneLock);
+    }
+}
+
+/*=============================================================================
+* heap compaction
+=============================================================================*/
+//retired zones stay in the list: lock-free readers walk it, so a zone is flagged in place
+//instead of unlinked, and its pages are handed back. fresh pages read as zero, which the
+//zone tail needs; the partial pages at either end are zeroed by hand
+static void releaseZonePages(char* start, char* end){
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    char* first = (char*)ALIGN_UP((uintptr_t)start, pageSize);
+    char* last = (char*)((uintptr_t)end & ~(uintptr_t)(pageSize - 1));
+    if (first >= last) {
+        blockZero(start, end - start);
+        return;
+    }
+    blockZero(start, first - start);
+    if (madvise(first, last - first, MADV_DONTNEED) != 0) {
+        blockZero(first, last - first);
+    }
+    blockZero(last, end - last);
+}
+
+//caller holds zone->zoneLock, the tail is adopted and every block in the list is free.
+//taking the whole tail by CAS keeps lock-free bumpers out; 0 when one got in first
+static size_t retireZoneMT(memZone* zone){
+    char* linked = zone->linkedEnd;
+    if (!__atomic_compare_exchange_n(&zone->bumpPtr, &linked, zone->endOfZone, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    __atomic_store_n(&zone->state, ZONE_RETIRED, __ATOMIC_RELAXED);
+    zone->zoneBlockList = NULL;
+    zone->largeFreeRoot = NULL;
+    zone->remainingSpace = 0;
+    zone->linkedEnd = zone->endOfZone; //nothing left for adoptZoneTailMT to link
+    __atomic_store_n(&zone->largestFree, 0, __ATOMIC_RELAXED);
+    releaseZonePages(zone->startOfZone, linked);
+    size_t size = zone->endOfZone - zone->startOfZone;
+    releaseHeapBytes(size);
+    return size;
+}
+
+//caller holds num_of_zones_lock; a retired zone of the group that can hold the block, taken
+//back as an empty zone
+static memZone* reviveZoneMT(allocHint group, size_t alignedSize, size_t alignment){
+    for (memZone* zone = zone_list_head; zone != NULL; zone = zone->next) {
+        if (zone->group != group || __atomic_load_n(&zone->state, __ATOMIC_RELAXED) != ZONE_RETIRED ||
+            sizeof(Block) + neededInZoneMT(alignedSize, alignment) > (size_t)(zone->endOfZone - zone->startOfZone)) {
+            continue;
+        }
+        mtLock(&zone->zoneLock);
+        //revived under us, or too big for what is left of the budget; a later one may still do
+        if (zone->state != ZONE_RETIRED || !reserveHeapBytes(zone->endOfZone - zone->startOfZone)) {
+            mtUnlock(&zone->zoneLock);
+            continue;
+        }
+        zone->linkedEnd = zone->startOfZone;
+        __atomic_store_n(&zone->state, ZONE_ACTIVE, __ATOMIC_RELAXED);
+        __atomic_store_n(&zone->bumpPtr, zone->startOfZone, __ATOMIC_RELEASE);
+        mtUnlock(&zone->zoneLock);
+        return zone;
+    }
+    return NULL;
+}
+
+//caller holds zone->zoneLock
+static size_t compactZoneMT(memZone* zone){
+    adoptZoneTailMT(zone);
+    coalesceZoneMT(zone);
+    size_t live = 0;
+    for (Block* block = zone->zoneBlockList; block != NULL; block = block->next) {
+        live += block->free ? 0 : sizeof(Block) + block->size;
+    }
+    if (live == 0) {
+        return retireZoneMT(zone);
+    }
+    size_t size = zone->endOfZone - zone->startOfZone;
+    __atomic_store_n(&zone->state, live <= size / ZONE_DRAIN_FRACTION ? ZONE_DRAINING : ZONE_ACTIVE,
+                     __ATOMIC_RELAXED);
+    return 0;
+}
+
+size_t customMTHeapCompact(){
+    size_t released = 0;
+    mtOpBegin();
+    //cached blocks would keep their zones alive
+    cpuCacheFlush();
+    for (memZone* zone = zone_list_head; zone != NULL; zone = __atomic_load_n(&zone->next, __ATOMIC_ACQUIRE)) {
+        mtLock(&zone->zoneLock);
+        if (zone->state != ZONE_RETIRED) {
+            released += compactZoneMT(zone);
+        }
+        mtUnlock(&zone->zoneLock);
+    }
+    mtOpEnd();
+    return released;
+}
+
+/*=============================================================================
+* batch allocation
+=============================================================================*/
+//caller holds zone->zoneLock
+static size_t carveManyInZoneMT(memZone* zone, size_t alignedSize, size_t alignment, size_t needed,
+                                void** out, size_t count){
+    size_t done = 0;
+    while (done < count && zone->largestFree >= needed) {
+        Block* block = carveBlockInZoneMT(zone, alignedSize, alignment);
+        if (block == NULL) {
+            break;
+        }
+        out[done++] = (void*)(block + 1);
+    }
+    return done;
+}
+
+static size_t carveTailManyInZoneMT(memZone* zone, size_t alignedSize, size_t alignment,
+                                    void** out, size_t count){
+    if (alignment <= 4) {
+        return bumpAllocManyInZoneMT(zone, alignedSize, out, count);
+    }
+    size_t done = 0;
+    while (done < count) {
+        Block* block = bumpAllocInZoneMT(zone, alignedSize, alignment);
+        if (block == NULL) {
+            break;
+        }
+        out[done++] = (void*)(block + 1);
+    }
+    return done;
+}
+
+size_t customMTMallocBatch(size_t size, size_t count, void** out){
+    mtOpBegin();
+    size_t done = mtMallocBatchImpl(size, count, out);
+    mtOpEnd();
+    return done;
+}
+
+static size_t mtMallocBatchImpl(size_t size, size_t count, void** out){
+    bool cacheAligned = __atomic_load_n(&mtCacheAligned, __ATOMIC_RELAXED);
+    size_t alignment = cacheAligned ? CACHE_LINE_SIZE : 4;
+    size_t alignedSize = cacheAligned ? ALIGN_UP(size, CACHE_LINE_SIZE) : ALIGN_TO_MULT_OF_4(size);
+    size_t needed = neededInZoneMT(alignedSize, alignment);
+    size_t done = 0;
+    if (out == NULL) {
+        return 0;
+    }
+    if (isLargeObject(alignedSize) || needed + sizeof(Block) > zoneCapacityMT()) {
+        while (done < count && (out[done] = mapLargeBlock(alignedSize, alignment)) != NULL) {
+            done++;
+        }
+        return done;
+    }
+    //every zone once: its tail without a lock, then its free blocks under a single lock acquisition
+    memZone* chosen = pickStartZoneMT(DEFAULT_LIVED);
+    memZone* zone = chosen;
+    while (zone != NULL) {
+        done += carveTailManyInZoneMT(zone, alignedSize, alignment, out + done, count - done);
+        if (done < count && __atomic_load_n(&zone->largestFree, __ATOMIC_RELAXED) >= needed) {
+            mtLock(&zone->zoneLock);
+            done += carveManyInZoneMT(zone, alignedSize, alignment, needed, out + done, count - done);
+            mtUnlock(&zone->zoneLock);
+        }
+        zone = nextZoneInGroupMT(zone, DEFAULT_LIVED);
+        if (zone == chosen || done == count) {
+            break;
+        }
+    }
+
+    while (done < count) {
+        mtLock(&num_of_zones_lock);
+        memZone* new_zone = create_new_zone(DEFAULT_LIVED);
+        if (new_zone != NULL) {
+            __atomic_store_n(&num_of_zones, num_of_zones + 1, __ATOMIC_RELAXED);
+        }
+        mtUnlock(&num_of_zones_lock);
+        if (new_zone == NULL) {
+            break;
+        }
+        size_t carved = carveTailManyInZoneMT(new_zone, alignedSize, alignment, out + done, count - done);
+        if (carved == 0) { //does not fit a zone at all
+            break;
+        }
+        done += carved;
+    }
+    return done;
+}
+
+static int comparePtrs(const void* a, const void* b){
+    uintptr_t left = (uintptr_t)*(void* const*)a;
+    uintptr_t right = (uintptr_t)*(void* const*)b;
+    return (left > right) - (left < right);
+}
+
+void customMTFreeBatch(void** ptrs, size_t count){
+    mtOpBegin();
+    mtFreeBatchImpl(ptrs, count);
+    mtOpEnd();
+}
+
+static void mtFreeBatchImpl(void** ptrs, size_t count){
+    if (ptrs == NULL) {
+        return;
+    }
+    //in address order every zone is one run, locked and coalesced once for the whole run
+    qsort(ptrs, count, sizeof(void*), comparePtrs);
+    size_t i = 0;
+    while (i < count) {
+        if (ptrs[i] == NULL) {
+            i++;
+            continue;
+        }
+        memZone* zone = findZoneMT(ptrs[i]);
+        if (zone == NULL) {
+            if (!unmapLargeBlock(ptrs[i])) {
+                printf("<free error>: passed non-heap pointer\n");
+            }
+            i++;
+            continue;
+        }
+        char* zoneEnd = zone->endOfZone;
+        mtLock(&zone->zoneLock);
+        adoptZoneTailMT(zone);
+        while (i < count && (char*)ptrs[i] < zoneEnd) {
+            Block* candidateBlock = getBlock(ptrs[i]);
+            if (blockOwnedMT(zone, candidateBlock) && !candidateBlock->free && !candidateBlock->binned &&
+                !candidateBlock->cached) {
+                candidateBlock->free = true;
+                zone->remainingSpace += candidateBlock->size + sizeof(Block);
+            }
+            else {
+                printf("<free error>: passed non-heap pointer\n");
+            }
+            i++;
+        }
+        coalesceZoneMT(zone);
+        mtUnlock(&zone->zoneLock);
+    }
+}
+/*=============================================================================
+* deferred free
+=============================================================================*/
+//every freeing thread owns one ring: it only moves head, the reclaim thread only moves tail
+deferredFreeRing* deferredFreeRings = NULL;
+pthread_mutex_t deferredFreeRingsLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread deferredFreeRing* myDeferredFreeRing = NULL;
+pthread_t reclaimThread;
+bool reclaimRunning = false;
+bool reclaimStop = false;
+pthread_mutex_t reclaimLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t reclaimWake = PTHREAD_COND_INITIALIZER;
+
+//a ring whose thread exited is taken over before a new one is mapped; only its producer side
+//changes hands, the reclaim thread keeps draining it either way
+static deferredFreeRing* registerDeferredFreeRing(){
+    watchThreadExit();
+    pthread_mutex_lock(&deferredFreeRingsLock);
+    for (deferredFreeRing* ring = deferredFreeRings; ring != NULL; ring = ring->next) {
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE)) {
+            ring->orphaned = false;
+            pthread_mutex_unlock(&deferredFreeRingsLock);
+            return ring;
+        }
+    }
+    pthread_mutex_unlock(&deferredFreeRingsLock);
+    deferredFreeRing* ring = mapChunk(ALIGN_UP(sizeof(deferredFreeRing), (size_t)sysconf(_SC_PAGESIZE)));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->head = 0;
+    ring->tail = 0;
+    ring->orphaned = false;
+    ring->pushing = false;
+    pthread_mutex_lock(&deferredFreeRingsLock);
+    ring->next = deferredFreeRings;
+    deferredFreeRings = ring;
+    pthread_mutex_unlock(&deferredFreeRingsLock);
+    return ring;
+}
+
+//false when the ring is full or deferred free was just turned off, the caller then frees right
+//away. pushing is raised before the flag is read again: customMTSetDeferredFree(false) clears
+//the flag before it looks at pushing, so either this push sees it off or its last drain waits
+//for the push and takes the entry
+static bool deferredFreePush(void* ptr){
+    deferredFreeRing* ring = myDeferredFreeRing;
+    if (ring == NULL) {
+        ring = myDeferredFreeRing = registerDeferredFreeRing();
+        if (ring == NULL) {
+            return false;
+        }
+    }
+    __atomic_store_n(&ring->pushing, true, __ATOMIC_SEQ_CST);
+    bool queued = false;
+    size_t head = ring->head;
+    if (__atomic_load_n(&deferredFreeEnabled, __ATOMIC_SEQ_CST) &&
+        head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != DEFERRED_FREE_RING_SIZE) {
+        ring->slots[head % DEFERRED_FREE_RING_SIZE] = ptr;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+        queued = true;
+    }
+    __atomic_store_n(&ring->pushing, false, __ATOMIC_RELEASE);
+    return queued;
+}
+
+//hands everything queued so far to the batch free, which sorts by zone and coalesces once per zone
+static void deferredFreeDrain(){
+    void* batch[DEFERRED_FREE_RING_SIZE];
+    pthread_mutex_lock(&deferredFreeRingsLock);
+    deferredFreeRing* rings = deferredFreeRings;
+    pthread_mutex_unlock(&deferredFreeRingsLock);
+    for (deferredFreeRing* ring = rings; ring != NULL; ring = ring->next) {
+        size_t tail = ring->tail;
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t count = 0;
+        while (tail != head) {
+            batch[count++] = ring->slots[tail % DEFERRED_FREE_RING_SIZE];
+            tail++;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        if (count > 0) {
+            customMTFreeBatch(batch, count);
+        }
+    }
+}
+
+static void* reclaimMain(void* arg){
+    pthread_mutex_lock(&reclaimLock);
+    while (!reclaimStop) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += DEFERRED_FREE_INTERVAL_US * 1000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&reclaimWake, &reclaimLock, &until);
+        pthread_mutex_unlock(&reclaimLock);
+        deferredFreeDrain();
+        pthread_mutex_lock(&reclaimLock);
+    }
+    pthread_mutex_unlock(&reclaimLock);
+    deferredFreeDrain();
+    return arg;
+}
+
+static void startReclaimThread(){
+    if (reclaimRunning) {
+        return;
+    }
+    reclaimStop = false;
+    if (pthread_create(&reclaimThread, NULL, reclaimMain, NULL) != 0) {
+        perror("Reclaim thread create failed");
+        __atomic_store_n(&deferredFreeEnabled, false, __ATOMIC_SEQ_CST);
+        return;
+    }
+    reclaimRunning = true;
+}
+
+//stops the reclaim thread after it drained every ring
+static void stopReclaimThread(){
+    if (!reclaimRunning) {
+        return;
+    }
+    pthread_mutex_lock(&reclaimLock);
+    reclaimStop = true;
+    pthread_cond_signal(&reclaimWake);
+    pthread_mutex_unlock(&reclaimLock);
+    pthread_join(reclaimThread, NULL);
+    reclaimRunning = false;
+}
+
+void customMTSetDeferredFree(bool enable){
+    if (enable) {
+        __atomic_store_n(&deferredFreeEnabled, true, __ATOMIC_SEQ_CST);
+        if (zone_list_head != NULL) {
+            startReclaimThread();
+        }
+    }
+    else {
+        __atomic_store_n(&deferredFreeEnabled, false, __ATOMIC_SEQ_CST);
+        stopReclaimThread();
+        //a push that read the flag before it went off lands after the reclaim thread's last
+        //drain; wait those out and drain once more from here
+        pthread_mutex_lock(&deferredFreeRingsLock);
+        deferredFreeRing* rings = deferredFreeRings;
+        pthread_mutex_unlock(&deferredFreeRingsLock);
+        for (deferredFreeRing* ring = rings; ring != NULL; ring = ring->next) {
+            while (__atomic_load_n(&ring->pushing, __ATOMIC_SEQ_CST)) {
+                sched_yield();
+            }
+        }
+        deferredFreeDrain();
+    }
+}
+
+void* customMTCalloc(size_t nmemb, size_t size){
+    void* startptr = customMTMalloc(size*nmemb);
+    if (startptr != NULL) {
+        blockZero(startptr, size*nmemb);
+    }
+    return startptr;
+}
+void* customMTRealloc(void* ptr, size_t size) {
+    mtOpBegin();
+    void* newPtr = mtReallocImpl(ptr, size);
+    mtOpEnd();
+    return newPtr;
+}
+
+//caller holds zone->zoneLock; cuts block down to size, slack that can hold a block goes back to the zone
+static void trimBlockInZoneMT(memZone* zone, Block* block, size_t size) {
+    if (block->size < size + sizeof(Block) + 4) {
+        return;
+    }
+    size_t slack = block->size - size;
+    Block* rest = (Block*)((char*)(block + 1) + size);
+    rest->size = slack - sizeof(Block);
+    rest->next = block->next;
+    rest->free = false;
+    rest->binned = false;
+    rest->cached = false;
+    sealBlock(rest, heapSecretMT);
+    block->size = size;
+    block->next = rest;
+    sealBlock(block, heapSecretMT);
+    releaseBlockInZoneMT(zone, block, rest);
+}
+
+//caller holds zone->zoneLock; grows block over a free right neighbour or into the untouched tail
+static bool growBlockInZoneMT(memZone* zone, Block* block, size_t size) {
+    Block* next = block->next;
+    if (next != NULL && next->free && block->size + sizeof(Block) + next->size >= size) {
+        freeIndexRemoveIfLarge(&zone->largeFreeRoot, next);
+        zone->remainingSpace -= next->size + sizeof(Block);
+        block->size += next->size + sizeof(Block);
+        block->next = next->next;
+        sealBlock(block, heapSecretMT);
+        updateZoneSummaryMT(zone);
+        trimBlockInZoneMT(zone, block, size);
+        return true;
+    }
+    //the last linked block borders the tail; claiming the tail races lock-free bumpers, so it goes by CAS
+    char* end = (char*)(block + 1) + block->size;
+    char* newEnd = (char*)(block + 1) + size;
+    if (next == NULL && end == zone->linkedEnd && newEnd <= zone->endOfZone &&
+        __atomic_compare_exchange_n(&zone->bumpPtr, &end, newEnd, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        zone->linkedEnd = newEnd;
+        block->size = size;
+        sealBlock(block, heapSecretMT);
+        return true;
+    }
+    return false;
+}
+
+//the zone is looked up and locked once: validation, in place resizing and moves inside the zone
+//all happen under that lock. only a block that has to leave its zone unlocks before moving
+static void* mtReallocImpl(void* ptr, size_t size) {
+    size = ALIGN_TO_MULT_OF_4(size);
+    if (ptr == NULL) {
+        return mtMallocImpl(size);
+    }
+    memZone* zone = findZoneMT(ptr);
+    if (zone == NULL) {
+        if (isMappedBlock(ptr)) {
+            return reallocLargeBlock(ptr, size, customMTMalloc, customMTFree);
+        }
+        printf("<realloc error>: passed non-heap pointer\n");
+        return NULL;
+    }
+    mtLock(&zone->zoneLock);
+    adoptZoneTailMT(zone);
+    Block* block = getBlock(ptr);
+    if (!blockOwnedMT(zone, block) || block->free || block->binned || block->cached) {
+        mtUnlock(&zone->zoneLock);
+        printf("<realloc error>: passed non-heap pointer\n");
+        return NULL;
+    }
+    if (size <= block->size) {
+        trimBlockInZoneMT(zone, block, size);
+        mtUnlock(&zone->zoneLock);
+        return ptr;
+    }
+    if (growBlockInZoneMT(zone, block, size)) {
+        mtUnlock(&zone->zoneLock);
+        return ptr;
+    }
+    size_t oldSize = block->size;
+    Block* moved = __atomic_load_n(&mtCacheAligned, __ATOMIC_RELAXED) ? carveBlockInZoneMT(zone, ALIGN_UP(size, CACHE_LINE_SIZE), CACHE_LINE_SIZE)
+                                  : carveBlockInZoneMT(zone, size, 4);
+    if (moved != NULL) {
+        blockCopy(moved + 1, ptr, oldSize);
+        releaseBlockInZoneMT(zone, NULL, block);
+        mtUnlock(&zone->zoneLock);
+        return (void*)(moved + 1);
+    }
+    mtUnlock(&zone->zoneLock);
+    //the new block stays in the old one's lifetime group
+    void* newPtr = zone->group == DEFAULT_LIVED ? mtMallocImpl(size) : mallocInZonesMT(size, 4, zone->group);
+    if (newPtr == NULL) {
+        return NULL;
+    }
+    blockCopy(newPtr, ptr, oldSize);
+    freeInZonesMT(ptr);
+    return newPtr;
+}
+int customHeapCreateWithConfig(const struct heapConfig* config){
+    if (config == NULL || !heapConfigValid(config)) {
+        printf("<config error>: invalid heap configuration\n");
+        return -1;
+    }
+    heapConf = *config;
+    heapConf.zoneSize = ALIGN_UP(config->zoneSize, CACHE_LINE_SIZE);
+    if (heapConf.maxZoneSize < heapConf.zoneSize) {
+        heapConf.maxZoneSize = heapConf.zoneSize;
+    }
+    heapConfLoaded = true;
+    heapSecretMT = newHeapSecret();
+    size_t heapBytes = heapConf.initialZones * (sizeof(memZone) + heapConf.zoneSize);
+    if (!reserveHeapBytes(heapBytes)) {
+        printf("<config error>: initial zones exceed the memory budget\n");
+        return -1;
+    }
+    if  ( (pthread_mutex_init(&num_of_zones_lock,NULL)) != 0) {
+        perror("Mutex init failed cry");
+        releaseHeapBytes(heapBytes);
+        return -1;
+    }
+    memZone* curr = NULL;
+    for (int i = 0; i < heapConf.initialZones; ++i) {
+        char* heapStart;
+        memZone* zone = newZoneMemory(heapConf.zoneSize, &heapStart);
+        if (zone == NULL || initZoneMT(zone, heapStart, heapConf.zoneSize) != 0) {
+            zone_list_head = NULL;
+            unmapHugeRegions();
+            releaseHeapBytes(heapBytes);
+            return -1;
+        }
+        if (curr == NULL) {
+            zone_list_head = zone;
         }
+        else {
+            curr->next = zone;
+        }
+        curr = zone;
     }
-    return (void*)(block + 1);
+    memset(groupZoneCount, 0, sizeof(groupZoneCount));
+    memset(groupFirstZone, 0, sizeof(groupFirstZone));
+    memset(groupNewestZone, 0, sizeof(groupNewestZone));
+    groupZoneCount[DEFAULT_LIVED] = heapConf.initialZones;
+    groupFirstZone[DEFAULT_LIVED] = zone_list_head;
+    groupNewestZone[DEFAULT_LIVED] = curr;
+    num_of_zones = heapConf.initialZones;
+    nextZoneSize = heapConf.zoneSize;
+    if (__atomic_load_n(&deferredFreeEnabled, __ATOMIC_RELAXED)) {
+        startReclaimThread();
+    }
+    return 0;
 }
-Block* getAndValidateBlockReturnPrev(void* ptr) {
-    if (ptr == NULL) {
-        return NULL;
+void heapCreate(){
+    heapConfig config = HEAP_CONFIG_DEFAULT;
+    heapConfigFromEnv(&config);
+    //entries that are fine alone can still fail together, e.g. zones past the budget
+    if (customHeapCreateWithConfig(&config) != 0) {
+        heapConfig fallback = HEAP_CONFIG_DEFAULT;
+        customHeapCreateWithConfig(&fallback);
     }
-    Block* candidateBlock = (Block*)ptr - 1;
-  //  printf("inside getandval\n");
-
-    Block* prev = blockList;
- //   printf("got prev\n");
-    while (prev->next != NULL) {
- //       printf("inside prev->next\n");
-        if (prev->next == candidateBlock) {
-    //       printf("found candidate\n");
-            return prev;
-        }
-        prev = prev->next;
+}
+void heapKill(){
+    //queued frees land before the zones go away
+    stopReclaimThread();
+    //cached blocks die with their zones
+    __atomic_store_n(&cpuCacheEnabled, false, __ATOMIC_RELEASE);
+    for (int cpu = 0; cpu < numCpuCaches; cpu++) {
+        memset(cpuCaches[cpu].bins, 0, sizeof(cpuCaches[cpu].bins));
+        memset(cpuCaches[cpu].counts, 0, sizeof(cpuCaches[cpu].counts));
     }
-  //  printf("we end\n");
-    return NULL;
+    while(zone_list_head != NULL) {
+        //customMTFree( (void*)(Zones[i].startOfZone+1)  );
+        //a retired zone gave its bytes back already
+        releaseHeapBytes(sizeof(memZone) + (zone_list_head->state == ZONE_RETIRED ? 0 :
+                         (size_t)(zone_list_head->endOfZone - zone_list_head->startOfZone)));
+        pthread_mutex_destroy( &(zone_list_head->zoneLock) );
+        zone_list_head->startOfZone = NULL;
+        zone_list_head->remainingSpace = 0;
+        zone_list_head->zoneBlockList = NULL;
+        zone_list_head = zone_list_head->next;
+    }
+    unmapHugeRegions();
+    pthread_mutex_destroy(&num_of_zones_lock);
+
 }
-Block* getAndValidateBlockReturnPrevMT(void* ptr, Block* blockListInSpecificZone ) {
 
-    if (ptr == NULL) {
-        return NULL;
+/*=============================================================================
+* heap statistics
+=============================================================================*/
+static void countBlock(heapStats* stats, Block* block){
+    stats->headerBytes += sizeof(Block);
+    if (block->free || block->binned) {
+        stats->freeBytes += block->size;
     }
+    else {
+        stats->liveBlocks++;
+        stats->liveBytes += block->size;
+    }
+}
 
-    Block* candidateBlock = (Block*)ptr - 1;
-    Block* prev = blockListInSpecificZone;
-    while (prev->next != NULL) {
-        if (prev->next == candidateBlock) {
-            return prev;
-        }
-        prev = prev->next;
+static void countSharedStats(heapStats* stats){
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    mtLock(&mappedBlocksLock);
+    for (Block* block = mappedBlocks; block != NULL; block = block->next) {
+        char* base = (char*)((uintptr_t)block & ~(uintptr_t)(pageSize - 1));
+        stats->mappedBytes += (char*)(block + 1) + block->size - base;
     }
-    return NULL;
+    mtUnlock(&mappedBlocksLock);
+    stats->footprint = customHeapFootprint();
 }
-void customFree(void* ptr){
-    if (ptr == NULL){
-        printf("<free error>: passed null pointer\n");
-        return;
+
+void customHeapStats(heapStats* stats){
+    memset(stats, 0, sizeof(*stats));
+    for (Block* block = blockList; block != NULL; block = block->next) {
+        countBlock(stats, block);
     }
+    countSharedStats(stats);
+}
 
-    Block* candidateBlock = (Block*)ptr - 1;
-  //  printf("found canidate\n");
-    if (blockList == candidateBlock){
-   //    printf(" canidate is top\n");
-        //check next
-        if (blockList->next!=NULL && blockList->next->free == true){
-      //      printf("next inside top\n");
-            blockList->size += blockList->next->size+ sizeof(Block);
-            blockList->next= blockList->next->next;
-            blockList->free = true;
-        }
-        blockList->free=true;
-        if (blockList->next == NULL){
-        //    printf("chk orgn\n");
-            if (brk(blockList)==BRK_FAIL) {
-                printf("<sbrk/brk error>: out of memory\n");
-                exit(1);
-            }
-            blockList=NULL;
+void customMTHeapStats(heapStats* stats){
+    memset(stats, 0, sizeof(*stats));
+    mtOpBegin();
+    for (memZone* zone = zone_list_head; zone != NULL; zone = __atomic_load_n(&zone->next, __ATOMIC_ACQUIRE)) {
+        mtLock(&zone->zoneLock);
+        adoptZoneTailMT(zone);
+        for (Block* block = zone->zoneBlockList; block != NULL; block = block->next) {
+            countBlock(stats, block);
         }
-
-        return;
+        stats->freeBytes += zone->endOfZone - zone->linkedEnd;
+        stats->retiredZones += zone->state == ZONE_RETIRED;
+        mtUnlock(&zone->zoneLock);
+        stats->zones++;
     }
+    mtOpEnd();
+    countSharedStats(stats);
+}
 
- //  printf("before getand val canidate\n");
-    Block* prev = getAndValidateBlockReturnPrev(ptr);
- //   printf("after getand val canidate\n");
-    if (prev == NULL) { //that means we didnt find the right one in the ll
-        printf("<free error>: passed non-heap pointer\n");
-        return;
-    }
-    //firsly, we want to free the curr block;
-    prev->next->free=true;
-    //check both sides
+/*=============================================================================
+* heap walks and snapshots
+=============================================================================*/
+static bool walkBlock(heapWalkCallback callback, void* ctx, Block* block, int zone){
+    heapBlockInfo info = {block, block->size, block->free || block->binned, false, zone};
+    return callback(&info, ctx);
+}
 
-   // printf("before big IF \n");
+static void walkMappedBlocks(heapWalkCallback callback, void* ctx){
+    mtLock(&mappedBlocksLock);
+    for (Block* block = mappedBlocks; block != NULL; block = block->next) {
+        if (!walkBlock(callback, ctx, block, HEAP_WALK_MAPPED)) {
+            break;
+        }
+    }
+    mtUnlock(&mappedBlocksLock);
+}
 
-    // now if it is the last block, we can free it and decrease brk
-    if (prev->next!= NULL && prev->next->next == NULL){
-   //     printf("check last\n");
-        if (prev->free){
-      //      printf("check prev\n");
-            prev->size += prev->next->size + sizeof(Block);
-            prev->next = prev->next->next;
-         //   printf("IN  prev\n");
-            if (prev->next == NULL){
-           //     printf("gem is right before BRK\n");
-                if (brk(prev) == BRK_FAIL){
-                    printf("<sbrk/brk error>: out of memory\n");
-                    exit(1);
-                }
-                if (prev == blockList) {
-                    blockList = NULL;
-                }
-                return;
-            }
+void customHeapWalk(heapWalkCallback callback, void* ctx){
+    for (Block* block = blockList; block != NULL; block = block->next) {
+        if (!walkBlock(callback, ctx, block, HEAP_WALK_LIST)) {
+            return;
         }
+    }
+    walkMappedBlocks(callback, ctx);
+}
 
-        if (brk(prev->next) == BRK_FAIL) {
-            printf("<sbrk/brk error>: out of memory\n");
-            exit(1);
+void customMTHeapWalk(heapWalkCallback callback, void* ctx){
+    bool going = true;
+    int index = 0;
+    mtOpBegin();
+    for (memZone* zone = zone_list_head; zone != NULL && going;
+         zone = __atomic_load_n(&zone->next, __ATOMIC_ACQUIRE), index++) {
+        mtLock(&zone->zoneLock);
+        adoptZoneTailMT(zone);
+        for (Block* block = zone->zoneBlockList; block != NULL && going; block = block->next) {
+            going = walkBlock(callback, ctx, block, index);
         }
-        prev->next=NULL;
-        if ((prev == blockList) && (prev->free == true)) {
-       //     printf("prev==blocklist\n\n");
-            blockList = NULL;
+        if (going && zone->linkedEnd < zone->endOfZone) {
+            heapBlockInfo tail = {zone->linkedEnd, zone->endOfZone - zone->linkedEnd, true, true, index};
+            going = callback(&tail, ctx);
         }
+        mtUnlock(&zone->zoneLock);
+    }
+    mtOpEnd();
+    if (going) {
+        walkMappedBlocks(callback, ctx);
     }
+}
+
+typedef struct snapshotWriter{
+    FILE* out;
+    bool failed;
+} snapshotWriter;
 
-   else if  ( (prev->free) && (prev->next->next!= NULL && prev->next->next->free) ){
-     //   printf("check both sides inside\n");
-        prev->next->size += prev->next->next->size + sizeof(Block);
+static bool writeSnapshotRecord(snapshotWriter* writer, const void* address, size_t size, int zone, uint32_t flags){
+    heapSnapshotRecord record = {(uint64_t)(uintptr_t)address, (uint64_t)size, (int32_t)zone, flags};
+    writer->failed = fwrite(&record, sizeof(record), 1, writer->out) != 1;
+    return !writer->failed;
+}
 
-        prev->size += prev->next->size + sizeof(Block);
+static bool snapshotBlock(const heapBlockInfo* info, void* ctx){
+    uint32_t flags = (info->free ? HEAP_SNAPSHOT_FREE : 0) | (info->tail ? HEAP_SNAPSHOT_TAIL : 0);
+    return writeSnapshotRecord(ctx, info->block, info->size, info->zone, flags);
+}
 
-        prev->next  = prev->next->next->next;
+int customHeapSnapshot(FILE* out, bool mt){
+    snapshotWriter writer = {out, false};
+    heapSnapshotHeader header;
+    memcpy(header.magic, HEAP_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.headerBytes = sizeof(Block);
+    header.zones = 0;
+    header.footprint = customHeapFootprint();
+    //zones are only ever added at the end of the list, their bounds never change
+    memZone* zones = mt ? zone_list_head : NULL;
+    for (memZone* zone = zones; zone != NULL; zone = __atomic_load_n(&zone->next, __ATOMIC_ACQUIRE)) {
+        header.zones++;
     }
-        //check next
-    else if( prev->next->next!= NULL && prev->next->next->free) {
-    //    printf("check next\n");
-        prev->next->size += prev->next->next->size + sizeof(Block);
-        prev->next->next = prev->next->next->next;
+    if (fwrite(&header, sizeof(header), 1, out) != 1) {
+        return -1;
     }
-        //check prev
-    else if (prev->free){
-    //    printf("check prev\n");
-        prev->size += prev->next->size + sizeof(Block);
-        prev->next = prev->next->next;
-     //   printf("IN  prev\n");
-        if (prev->next == NULL){
-        //    printf("before BRK\n");
-            if (brk(prev) == BRK_FAIL){
-                printf("<sbrk/brk error>: out of memory\n");
-                exit(1);
-            }
-            if (prev == blockList) {
-                blockList = NULL;
-            }
-            return;
+    int index = 0;
+    for (memZone* zone = zones; zone != NULL && index < (int)header.zones; zone = zone->next, index++) {
+        if (!writeSnapshotRecord(&writer, zone->startOfZone, zone->endOfZone - zone->startOfZone, index,
+                                 HEAP_SNAPSHOT_ZONE)) {
+            return -1;
         }
     }
-
-    return;
+    if (mt) {
+        customMTHeapWalk(snapshotBlock, &writer);
+    }
+    else {
+        customHeapWalk(snapshotBlock, &writer);
+    }
+    return writer.failed || fflush(out) != 0 ? -1 : 0;
 }
-void* customCalloc(size_t nmemb, size_t size){
-    void* startptr = customMalloc(size*nmemb);
-    char* chrptr =  (char*)startptr;
-    for (int i = 0; i < size*nmemb ; ++i) {
-        *chrptr = 0;
-        chrptr++;
+
+/*=============================================================================
+* arenas
+=============================================================================*/
+void* mapChunk(size_t size){
+    void* chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED) {
+        printf("<mmap error>: out of memory\n");
+        return NULL;
     }
-    return startptr;
+    return chunk;
 }
 
-void* customRealloc(void* ptr, size_t size){
-    size = ALIGN_TO_MULT_OF_4(size);
-    if (ptr==NULL){
-        return (void*)customMalloc(size);
+//arena chunks and pool pages count against the memory budget like heap memory
+static arenaChunk* newArenaChunk(size_t minPayload){
+    size_t total = ALIGN_UP(minPayload + sizeof(arenaChunk), (size_t)sysconf(_SC_PAGESIZE));
+    if (!reserveHeapBytes(total)) {
+        return NULL;
     }
-    Block* prev = getAndValidateBlockReturnPrev(ptr);
-    if (  (prev==NULL) && ( blockList!=( (Block*)ptr - 1) )  ){
-        printf("<realloc error>: passed non-heap pointer\n");
+    arenaChunk* chunk = mapChunk(total);
+    if (chunk == NULL) {
+        releaseHeapBytes(total);
         return NULL;
     }
-    Block* header = (Block*)ptr - 1;
-    size_t old_size = header->size;
-    if (size>=old_size){
-        Block* newBlock = customMalloc(size);
-        memcpy(newBlock,ptr,old_size);
-        customFree(ptr);
-        return (void*)newBlock;
+    chunk->next = NULL;
+    chunk->size = total - sizeof(arenaChunk);
+    chunk->used = 0;
+    return chunk;
+}
+
+customArena* customArenaCreate(size_t initial_size){
+    size_t header = ALIGN_TO_MULT_OF_4(sizeof(customArena));
+    arenaChunk* first = newArenaChunk(header + initial_size);
+    if (first == NULL) {
+        return NULL;
     }
-    if (size<old_size){
-        char* end_ptr_mem =(char*)ptr+size ;
-        size_t sizeToFree = old_size - size ;
-       // char start_ptr_to_free = old_size - size ;
-        Block* curr;
-        if ( blockList==( (Block*)ptr - 1) ) {
-            curr = blockList;
-        }
-        else{
-            curr=prev->next;
-        }
-        Block* BlocktoFree =(Block*)end_ptr_mem;
-        BlocktoFree->free=true;
-        if (sizeToFree>sizeof(Block)){
-         //   printf("@@@@@@\n");
-            BlocktoFree->size= sizeToFree - sizeof(Block);
-            BlocktoFree->next= curr->next;
-            curr->next=(Block*)end_ptr_mem;
-            curr->size=size;
-            curr->free=false;
-            customFree((void*)((Block*)end_ptr_mem + 1));
-            return (void*)(curr+1) ;
+    customArena* arena = (customArena*)(first + 1);
+    first->used = header;
+    arena->first = first;
+    arena->current = first;
+    return arena;
+}
+
+void* customArenaAlloc(customArena* arena, size_t size){
+    if (arena == NULL || size == 0) {
+        return NULL;
+    }
+    size_t alignedSize = ALIGN_TO_MULT_OF_4(size);
+    arenaChunk* chunk = arena->current;
+    while (chunk->size - chunk->used < alignedSize) {
+        //chunks kept from before the last reset are reused before mapping new ones
+        if (chunk->next != NULL && chunk->next->size >= alignedSize) {
+            chunk = chunk->next;
+            chunk->used = 0;
+            continue;
         }
-        else{
-            Block* newBlock = customMalloc(size);
-            memcpy(newBlock,ptr,size);
-            customFree(ptr);
-            return (void*)newBlock;
+        size_t grow = chunk->size * 2 > alignedSize ? chunk->size * 2 : alignedSize;
+        arenaChunk* fresh = newArenaChunk(grow);
+        if (fresh == NULL) {
+            return NULL;
         }
+        fresh->next = chunk->next;
+        chunk->next = fresh;
+        chunk = fresh;
     }
-   // printf("DEBUG BAD IN REALLOC");
-    return NULL;
+    arena->current = chunk;
+    void* ptr = (char*)(chunk + 1) + chunk->used;
+    chunk->used += alignedSize;
+    return ptr;
 }
 
-void* customMTMalloc(size_t size) {
-    size_t alignedSize = ALIGN_TO_MULT_OF_4(size);
-    pthread_mutex_lock(&num_of_zones_lock);
-
-
-    pthread_mutex_lock(&memZoneIndxLock);
-
-
-    int localIndx = memZoneIndx % num_of_zones;
-    memZoneIndx++;
-
+void customArenaReset(customArena* arena){
+    if (arena == NULL) {
+        return;
+    }
+    arena->current = arena->first;
+    arena->first->used = ALIGN_TO_MULT_OF_4(sizeof(customArena));
+}
 
-    pthread_mutex_unlock(&memZoneIndxLock);
+void customArenaDestroy(customArena* arena){
+    if (arena == NULL) {
+        return;
+    }
+    arenaChunk* first = arena->first;
+    arenaChunk* chunk = first->next;
+    while (chunk != NULL) {
+        arenaChunk* next = chunk->next;
+        size_t total = chunk->size + sizeof(arenaChunk);
+        munmap(chunk, total);
+        releaseHeapBytes(total);
+        chunk = next;
+    }
+    size_t total = first->size + sizeof(arenaChunk);
+    munmap(first, total);
+    releaseHeapBytes(total);
+}
 
+/*=============================================================================
+* object pools
+=============================================================================*/
+static __thread poolMagazine poolMagazines[POOL_MAGAZINES_PER_THREAD];
+static __thread int poolMagazineEvict = 0;
+unsigned long nextPoolId = 1;
+
+//the first page holds the pool itself, so it goes last
+static void poolUnmap(customPool* pool){
+    pthread_mutex_destroy(&pool->lock);
+    poolPage* page = pool->pages;
+    while (page != NULL) {
+        poolPage* next = page->next;
+        size_t size = page->size;
+        munmap(page, size);
+        releaseHeapBytes(size);
+        page = next;
+    }
+}
 
-    memZone* curr = zone_list_head;
-    memZone* chosen;
-    for (int i = 0; i<localIndx+1 ; i++){
-       // printf("section IS %d \n ",i);
-        chosen = curr;
-        curr = curr->next;
+//caller holds pool->lock
+static void* poolTakeLocked(customPool* pool){
+    void* obj = pool->freeList;
+    if (obj != NULL) {
+        pool->freeList = *(void**)obj;
+        return obj;
     }
-   // printf("GOT CHOSEN ONE !!\n");
-    pthread_mutex_lock((&chosen->zoneLock));
-    if (chosen->remainingSpace < alignedSize + sizeof(Block)) { //there isn't enough space...
-    //    printf("try to create new zone\n");
-        memZone* new_zone = create_new_zone();
-    //    printf("Create new ZONE good \n");
-        if (new_zone == NULL){
-            printf("OUT OF MEMORY WE ARE HERE");
-            pthread_mutex_unlock(&num_of_zones_lock);
+    if (pool->carve + pool->objectSize > pool->carveEnd) {
+        if (!reserveHeapBytes(pool->pageSize)) {
             return NULL;
         }
-        num_of_zones++;
-        //chosen = new_zone;
-
+        poolPage* page = mapChunk(pool->pageSize);
+        if (page == NULL) {
+            releaseHeapBytes(pool->pageSize);
+            return NULL;
+        }
+        page->size = pool->pageSize;
+        page->next = pool->pages;
+        pool->pages = page;
+        pool->carve = (char*)ALIGN_UP((uintptr_t)(page + 1), pool->alignment);
+        pool->carveEnd = (char*)page + pool->pageSize;
     }
-  //  printf("not iside chosen remaining space\n");
-    for (int i = 0; i < num_of_zones; ++i) {
-       // int currZoneIndx = (localIndx + i) % num_of_zones;
-    //    printf("iter number IS %d \n ",i);
-        if (chosen->remainingSpace >= (alignedSize + sizeof(Block))){
-
-        //    printf("before bestFit\n");
-            Block *block = findBestFitInZoneMT(chosen, alignedSize);
-       //     printf("after bestFit\n");
-            if (block != NULL) {
-
-                block->free = false;
-
-                size_t remainingSize = block->size - alignedSize;
-
-                if (remainingSize >= sizeof(Block) + 4) {
-
-                    block->size = alignedSize;
-                    Block *newBlock = (Block *) ((char *) block + sizeof(Block) + alignedSize);
-
-                    newBlock->size = remainingSize - sizeof(Block);
-                    newBlock->free = true;
-                    newBlock->next = block->next;
-                    block->next = newBlock;
-                }
-
-                chosen->remainingSpace -= (block->size + sizeof(Block));
-                // Unlock and return User Pointer
-                pthread_mutex_unlock(&chosen->zoneLock);
-                pthread_mutex_unlock(&num_of_zones_lock);
-                return (void *) (block + 1);
+    obj = pool->carve;
+    pool->carve += pool->objectSize;
+    return obj;
+}
 
-            }
-        }
+//hands the objects past keep back to the pool. a magazine holds its pool mapped until it
+//detaches, so the pool is never touched after another thread destroyed and unmapped it;
+//the objects of a destroyed pool went with it
+static void poolMagazineFlush(poolMagazine* mag, int keep, bool detach){
+    customPool* pool = mag->pool;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->destroyed) {
+        mag->count = 0;
+        detach = true;
+    }
+    while (mag->count > keep) {
+        void* obj = mag->objs[--mag->count];
+        *(void**)obj = pool->freeList;
+        pool->freeList = obj;
+    }
+    bool last = false;
+    if (detach) {
+        last = --pool->magazines == 0 && pool->destroyed;
+        mag->pool = NULL;
+        mag->poolId = 0;
+        mag->count = 0;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (last) {
+        poolUnmap(pool);
+    }
+}
 
-        if (chosen->next == NULL){
-            pthread_mutex_unlock((&chosen->zoneLock));
-            chosen = zone_list_head;
-            pthread_mutex_lock((&chosen->zoneLock));
+static poolMagazine* poolMagazineFor(customPool* pool){
+    poolMagazine* empty = NULL;
+    for (int i = 0; i < POOL_MAGAZINES_PER_THREAD; i++) {
+        if (poolMagazines[i].poolId == pool->id) {
+            return &poolMagazines[i];
         }
-        else {
-            pthread_mutex_unlock((&chosen->zoneLock));
-            chosen = chosen->next;
-            pthread_mutex_lock((&chosen->zoneLock));
+        if (empty == NULL && poolMagazines[i].poolId == 0) {
+            empty = &poolMagazines[i];
         }
     }
-    pthread_mutex_unlock((&chosen->zoneLock));
-    pthread_mutex_unlock(&num_of_zones_lock);
- //   printf("OUT OF MEMORY WE ARE HERE");
-    return NULL;
+    if (empty == NULL) { //all slots taken, hand one back to its pool
+        empty = &poolMagazines[poolMagazineEvict];
+        poolMagazineEvict = (poolMagazineEvict + 1) % POOL_MAGAZINES_PER_THREAD;
+        poolMagazineFlush(empty, 0, true);
+    }
+    watchThreadExit();
+    pthread_mutex_lock(&pool->lock);
+    pool->magazines++;
+    pthread_mutex_unlock(&pool->lock);
+    empty->pool = pool;
+    empty->poolId = pool->id;
+    empty->count = 0;
+    return empty;
 }
-void customMTFree(void* ptr){
-    memZone* curr = zone_list_head;
-    while (curr != NULL) {
-        if (  !( ( (char*)curr->startOfZone <= (char*)ptr ) && ((char*)ptr < ( (char*)(curr->startOfZone+4*1024)) ) ) ){
-            curr = curr->next;
-            continue;
-        }
-        else{
-            pthread_mutex_lock(&curr->zoneLock);
-            if (ptr == NULL){
-                printf("<freeMT error>: passed null pointer\n");
-                pthread_mutex_unlock(&(curr->zoneLock));
-                return;
-            }
-            Block* candidateBlock = (Block*)ptr - 1;
-            if (curr->zoneBlockList == candidateBlock){
-                curr->remainingSpace +=  ( curr->zoneBlockList->size + sizeof(Block) ) ;
-                //check next
-                if (curr->zoneBlockList->next!=NULL && curr->zoneBlockList->next->free == true){
-                    curr->zoneBlockList->size += curr->zoneBlockList->next->size+ sizeof(Block);
-                    curr->zoneBlockList->next= curr->zoneBlockList->next->next;
-                    curr->zoneBlockList->free = true;
-                }
-                //check origin of the blockList
-                if (curr->zoneBlockList->next == NULL){
-/*                    if (brk(Zones[i].zoneBlockList)==SBRK_FAIL) {
-                        printf("<sbrk/brk error>: out of memory\n");
-                        exit(1);
-                    }*/
-                    //Zones[i].zoneBlockList=NULL;
-                    curr->zoneBlockList->free=1;
-                }
-                curr->zoneBlockList->free=true;
-                pthread_mutex_unlock(&curr->zoneLock);
-                return;
-            }
-            Block* prev = getAndValidateBlockReturnPrevMT(ptr, curr->zoneBlockList);
-
-            if (prev == NULL) { //that means we didnt find the right one in the ll
-                printf("<free error>: passed non-heap pointer\n");
-                pthread_mutex_unlock(&curr->zoneLock);
-                return;
-            }
-            curr->remainingSpace +=  ( prev->next->size + sizeof(Block) ) ;
-            //firsly, we want to free the curr block;
-            prev->next->free=true;
-            //check both sides
-            if  ( (prev->free) && (prev->next->next!= NULL && prev->next->next->free) ){
-                prev->next->size += prev->next->next->size + sizeof(Block);
-
-                prev->size += prev->next->size + sizeof(Block);
-
-                prev->next  = prev->next->next->next;
-            }
-                //check next
-            else if( prev->next->next!= NULL && prev->next->next->free) {
-                prev->next->size += prev->next->next->size + sizeof(Block);
-                prev->next->next = prev->next->next->next;
-            }
-                //check prev
-            else if (prev->free ){
-                prev->size += prev->next->size + sizeof(Block);
-                prev->next = prev->next->next;
-            }
-            // now if it is the last block, we can free it
-
 
-
-            if (prev->next!= NULL && prev->next->next == NULL){
-                prev->next->free=1; // ?
-            }
-            pthread_mutex_unlock(&curr->zoneLock);
-            return;
-        }}
-}
-void* customMTCalloc(size_t nmemb, size_t size){
-    void* startptr = customMTMalloc(size*nmemb);
-    char* chrptr =  (char*)startptr;
-    for (int i = 0; i < size*nmemb ; ++i) {
-        *chrptr = 0;
-        chrptr++;
+customPool* customPoolCreate(size_t object_size, size_t alignment){
+    if (object_size == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
     }
-    return startptr;
+    if (alignment < sizeof(void*)) {
+        alignment = sizeof(void*); //free objects hold a pointer
+    }
+    size_t objectSize = ALIGN_UP(object_size, alignment);
+    size_t pageSize = POOL_PAGE_SIZE;
+    size_t minPage = ALIGN_UP(sizeof(customPool) + sizeof(poolPage) + alignment + 8 * objectSize,
+                              (size_t)sysconf(_SC_PAGESIZE));
+    if (minPage > pageSize) {
+        pageSize = minPage;
+    }
+    if (!reserveHeapBytes(pageSize)) {
+        return NULL;
+    }
+    poolPage* page = mapChunk(pageSize);
+    if (page == NULL) {
+        releaseHeapBytes(pageSize);
+        return NULL;
+    }
+    page->size = pageSize;
+    page->next = NULL;
+    customPool* pool = (customPool*)(page + 1);
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        perror("Mutex init failed");
+        munmap(page, pageSize);
+        releaseHeapBytes(pageSize);
+        return NULL;
+    }
+    pool->objectSize = objectSize;
+    pool->alignment = alignment;
+    pool->pageSize = pageSize;
+    pool->freeList = NULL;
+    pool->pages = page;
+    pool->carve = (char*)ALIGN_UP((uintptr_t)(pool + 1), alignment);
+    pool->carveEnd = (char*)page + pageSize;
+    pool->magazines = 0;
+    pool->destroyed = false;
+    pool->id = __atomic_fetch_add(&nextPoolId, 1, __ATOMIC_RELAXED);
+    return pool;
 }
-void* customMTRealloc(void* ptr, size_t size) {
-    size = ALIGN_TO_MULT_OF_4(size);
-    if (ptr == NULL) {
-        return (void *) customMTMalloc(size);
+
+void* customPoolAlloc(customPool* pool){
+    if (pool == NULL) {
+        return NULL;
     }
-    memZone* curr_zone = zone_list_head;
-    while (curr_zone != NULL)
-    {
-        if (  !( ( (char*)curr_zone->startOfZone <= (char*)ptr ) && ((char*)ptr < ( (char*)(curr_zone->startOfZone+4*1024)) ) ) ){
-            curr_zone = curr_zone->next;
-            continue;
-        }
-        else {
-            pthread_mutex_lock(&curr_zone->zoneLock);
-            Block *prev_block = getAndValidateBlockReturnPrevMT(ptr, curr_zone->zoneBlockList);
-            pthread_mutex_unlock(&curr_zone->zoneLock);
-            if ((prev_block == NULL) && (curr_zone->zoneBlockList != ((Block *) ptr - 1))) {
-                printf("<realloc error>: passed non-heap pointer\n");
-                return NULL;
-            }
-            Block *header = (Block *) ptr - 1;
-            size_t old_size = header->size;
-
-            if (size >= old_size) {
-                Block *newBlock = customMTMalloc(size);
-                if (!newBlock) return NULL;
-                memcpy(newBlock, ptr, old_size);
-                customMTFree(ptr);
-                return (void *) newBlock;
-            }
-            if (size < old_size) {
-                pthread_mutex_lock(&curr_zone->zoneLock);
-                char *end_ptr_mem = (char *) ptr + size;
-                size_t sizeToFree = old_size - size;
-
-                Block *curr_block;
-                if (curr_zone->zoneBlockList == ((Block *) ptr - 1)) {
-                    curr_block = curr_zone->zoneBlockList;
-                } else {
-                    curr_block = prev_block->next;
-                }
-                Block *BlocktoFree = (Block *) end_ptr_mem;
-                BlocktoFree->free = true;
-                if (sizeToFree > sizeof(Block)) {
-                    BlocktoFree->size = sizeToFree - sizeof(Block);
-                    BlocktoFree->next = curr_block->next;
-                    curr_block->next = (Block*)end_ptr_mem;
-                    curr_block->size = size;
-                    curr_block->free = false;
-                    pthread_mutex_unlock(&curr_zone->zoneLock);
-                    customMTFree((void *) ((Block *) end_ptr_mem + 1));
-                    return (void *) (curr_block + 1);
-                } else {
-                    pthread_mutex_unlock(&curr_zone->zoneLock);
-                    Block *newBlock = customMTMalloc(size);
-                    pthread_mutex_lock(&curr_zone->zoneLock);
-                    memcpy(newBlock, ptr, size);
-                    pthread_mutex_unlock(&curr_zone->zoneLock);
-                    customMTFree(ptr);
-                    return (void *) newBlock;
-                }
-            }
+    poolMagazine* mag = poolMagazineFor(pool);
+    if (mag->count > 0) {
+        return mag->objs[--mag->count];
+    }
+    //refill half a magazine under one lock
+    pthread_mutex_lock(&pool->lock);
+    void* obj = poolTakeLocked(pool);
+    while (obj != NULL && mag->count < heapConf.poolMagazineSize / 2) {
+        void* extra = poolTakeLocked(pool);
+        if (extra == NULL) {
+            break;
         }
+        mag->objs[mag->count++] = extra;
     }
-   // printf("REALLOCMT ERRRRR\n");
-    return NULL;
+    pthread_mutex_unlock(&pool->lock);
+    return obj;
 }
-void heapCreate(){
-    if  ( (pthread_mutex_init(&num_of_zones_lock,NULL)) != 0) {
-        perror("Mutex init failed cry");
+
+void customPoolFree(customPool* pool, void* ptr){
+    if (pool == NULL || ptr == NULL) {
         return;
     }
+    poolMagazine* mag = poolMagazineFor(pool);
+    if (mag->count >= heapConf.poolMagazineSize) {
+        poolMagazineFlush(mag, heapConf.poolMagazineSize / 2, false);
+    }
+    mag->objs[mag->count++] = ptr;
+}
 
-
-    if  ( (pthread_mutex_init(&memZoneIndxLock,NULL)) != 0) {
-        perror("Mutex init failed cry");
+//magazines of other threads keep the pool mapped until they next touch it or exit
+void customPoolDestroy(customPool* pool){
+    if (pool == NULL) {
         return;
     }
-    void* metadata = (void*)sbrk(sizeof(memZone));
-    if (metadata == (void*)-1) {
-        printf("<sbrk/brk error>: out of memory\n");
-        exit(1);
-    }
-    zone_list_head = metadata;
-    memZone* curr = zone_list_head;
-    for (int i = 0; i < 8; ++i) {
-        void* heapStart = (void*)sbrk(4 * 1024);
-        if (pthread_mutex_init(&(curr->zoneLock), NULL) != 0) {
-            perror("Mutex init failed");
-            return;
+    pthread_mutex_lock(&pool->lock);
+    pool->destroyed = true;
+    for (int i = 0; i < POOL_MAGAZINES_PER_THREAD; i++) {
+        if (poolMagazines[i].poolId == pool->id) {
+            pool->magazines--;
+            poolMagazines[i].pool = NULL;
+            poolMagazines[i].poolId = 0;
+            poolMagazines[i].count = 0;
         }
-        curr->startOfZone = (char*)heapStart;
-        curr->remainingSpace = 4 * 1024;
-
-        Block* initialBlock = (Block*)curr->startOfZone;
-        initialBlock->size =ALIGN_TO_MULT_OF_4( (4 * 1024) - sizeof(Block));
-        initialBlock->free = true;
-        initialBlock->next = NULL;
+    }
+    bool last = pool->magazines == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if (last) {
+        poolUnmap(pool);
+    }
+}
 
-        curr->zoneBlockList = initialBlock;
-        if (i<7){
-            void* new = (void*) sbrk(sizeof(memZone));
-            curr->next = new;
-            curr = curr->next;
+/*=============================================================================
+* thread lifecycle
+=============================================================================*/
+//a thread that set up per-thread state holds a value under this key, so the destructor
+//runs when it exits
+static pthread_key_t threadExitKey;
+static pthread_once_t threadExitKeyOnce = PTHREAD_ONCE_INIT;
+static __thread bool threadExitWatched = false;
+
+//runs in the exiting thread: cached pool objects go back to their pools and the deferred
+//free ring is left to the reclaim thread and to the next thread that needs a ring
+static void threadExit(void* unused){
+    (void)unused;
+    for (int i = 0; i < POOL_MAGAZINES_PER_THREAD; i++) {
+        if (poolMagazines[i].poolId != 0) {
+            poolMagazineFlush(&poolMagazines[i], 0, true);
         }
-
-
+    }
+    if (myDeferredFreeRing != NULL) {
+        __atomic_store_n(&myDeferredFreeRing->orphaned, true, __ATOMIC_RELEASE);
+        myDeferredFreeRing = NULL;
     }
 }
-void heapKill(){
-    while(zone_list_head != NULL) {
-        //customMTFree( (void*)(Zones[i].startOfZone+1)  );
-        pthread_mutex_destroy( &(zone_list_head->zoneLock) );
-        zone_list_head->startOfZone = NULL;
-        zone_list_head->remainingSpace = 4 *1024;
-        zone_list_head->zoneBlockList = NULL;
-        zone_list_head = zone_list_head->next;
+
+static void createThreadExitKey(){
+    if (pthread_key_create(&threadExitKey, threadExit) != 0) {
+        perror("Thread key create failed");
     }
-    pthread_mutex_destroy(&memZoneIndxLock);
+}
 
-}
\ No newline at end of file
+static void watchThreadExit(){
+    if (threadExitWatched) {
+        return;
+    }
+    threadExitWatched = true;
+    pthread_once(&threadExitKeyOnce, createThreadExitKey);
+    pthread_setspecific(threadExitKey, &threadExitWatched);
+}
@@ -27,6 +27,7 @@ void heapKill();
 /*=============================================================================
 * do no edit lines above!
 =============================================================================*/
+#include <stdint.h>
 
 /*=============================================================================
 * defines
@@ -34,6 +35,8 @@ void heapKill();
 #define SBRK_FAIL (void*)(-1)
 #define ALIGN_TO_MULT_OF_4(x) (((((x) - 1) >> 2) << 2) + 4)
 #define BRK_FAIL -1
+#define CACHE_LINE_SIZE 64
+#define ALIGN_UP(x, a) ((((x) + (a) - 1) / (a)) * (a))
 /*=============================================================================
 * Block
 =============================================================================*/
@@ -42,26 +45,414 @@ typedef struct Block{
     size_t size;
     struct Block* next;
     bool free;
+    bool binned; //waiting in a fast bin: neither merged nor live
+    bool cached; //waiting in a per-CPU cache
+    uint32_t seal; //address and size mixed with the heap secret, checked on free
 } Block;
 
+//tree links of a free block in the large free block index, kept in its payload
+typedef struct freeNode{
+    struct Block* left;
+    struct Block* right;
+    struct Block* parent;
+    bool red;
+} freeNode;
+
+#define FREE_NODE(b) ((freeNode*)((b) + 1))
+#define LARGE_BLOCK_THRESHOLD 256 //free blocks from here up are found through the index
+
+//freed blocks of FAST_BIN_MIN..FAST_BIN_MAX bytes wait unmerged in a bin per 4 byte size;
+//a miss or an overfull bin merges them all back (consolidation)
+#define FAST_BIN_MIN 8   //the first word of the payload links the bin
+#define FAST_BIN_MAX 128
+#define FAST_BINS ((FAST_BIN_MAX - FAST_BIN_MIN) / 4 + 1)
+#define FAST_BIN_DEPTH 64 //blocks per bin before consolidation, the most heapConfig allows
+
+typedef struct fastBinSet{
+    void* bins[FAST_BINS];
+    uint8_t counts[FAST_BINS];
+    uint32_t mask; //bins holding blocks, one bit each; zones read it without their lock
+    bool unmerged; //a freed block may sit after a free block it was not merged with
+} fastBinSet;
+
+/*=============================================================================
+* heap configuration
+=============================================================================*/
+typedef enum zoneGrowth{
+    ZONE_GROWTH_FIXED,  //every new zone has zoneSize bytes
+    ZONE_GROWTH_DOUBLE  //every new zone doubles the last one, up to maxZoneSize
+} zoneGrowth;
+
+//size classes stay compile time (CPU_CACHE_CLASSES, POOL_MAGAZINE_SIZE...), the
+//cache sizes here only limit how much of those tables is used
+typedef struct heapConfig{
+    int initialZones;            //zones heapCreate builds up front
+    size_t zoneSize;             //bytes of the first zones, rounded up to a cache line
+    zoneGrowth growth;
+    size_t maxZoneSize;
+    int cpuCacheDepth;           //blocks per per-CPU bin, at most CPU_CACHE_DEPTH
+    int fastBinDepth;            //blocks per fast bin, at most FAST_BIN_DEPTH; 0 merges on every free
+    int poolMagazineSize;        //objects per pool magazine, 2 up to POOL_MAGAZINE_SIZE
+    size_t trimThreshold;        //customFree gives the heap top back once this much is free there
+    size_t largeObjectThreshold; //requests this big get a mapping of their own, 0 turns it off
+    size_t memoryBudget;         //bytes of heap the allocator may take from the system, 0 means no limit
+    bool hugePages;              //zones and large objects from 2 MiB aligned mappings advised for huge pages
+    bool checkFreeSize;          //sized frees compare their size with the block header
+} heapConfig;
+
+#define HEAP_CONFIG_DEFAULT {8, 4 * 1024, ZONE_GROWTH_FIXED, 4 * 1024, CPU_CACHE_DEPTH, \
+                             FAST_BIN_DEPTH, POOL_MAGAZINE_SIZE, 0, 128 * 1024, 0, false, false}
+
+extern heapConfig heapConf;
+
+//heapCreate with explicit parameters, -1 when the configuration is invalid
+int customHeapCreateWithConfig(const struct heapConfig* config);
+//applies CUSTOM_MALLOC_CONF, e.g. "zones:16,zone_size:64k,growth:double,max_zone_size:1m,
+//cache_depth:8,fast_bin_depth:16,magazine:16,trim_threshold:128k,large_threshold:256k,budget:64m,huge_pages:1,
+//check_free_size:1". keys left out keep
+//their value, -1 when an entry could not be used
+int heapConfigFromEnv(heapConfig* config);
+
+/*=============================================================================
+* huge pages
+=============================================================================*/
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+//zones are packed back to back into these regions, the header sits at the region start
+typedef struct hugeRegion{
+    struct hugeRegion* next;
+    size_t size;
+    size_t used;
+} hugeRegion;
+
+typedef struct hugePageStats{
+    size_t reservedBytes; //mappings advised for huge pages
+    size_t residentBytes; //of those, resident
+    size_t hugeBytes;     //of those, backed by huge pages
+} hugePageStats;
+
+//reads /proc/self/smaps, -1 when it cannot
+int customHugePageStats(hugePageStats* stats);
+
+/*=============================================================================
+* memory budget
+=============================================================================*/
+//called once an allocation would pass the budget even after the allocator gave back its
+//caches and merged its free lists; the allocation is retried after it returns
+typedef void (*lowMemoryHandler)(size_t requested);
+
+void customSetLowMemoryHandler(lowMemoryHandler handler);
+//bytes of zones, heap blocks, large mappings, arena chunks and pool pages currently held, all
+//capped by heapConfig.memoryBudget. the allocator's own bookkeeping is left out: per-CPU cache
+//slabs and deferred free rings, one small fixed piece per CPU or thread
+size_t customHeapFootprint();
+
+/*=============================================================================
+* heap statistics
+=============================================================================*/
+typedef struct heapStats{
+    size_t liveBlocks;
+    size_t liveBytes;    //payload of allocated blocks, per-CPU cached blocks included
+    size_t headerBytes;  //Block headers, free blocks included
+    size_t freeBytes;    //held but unused: free block payload and untouched zone tails
+    size_t zones;
+    size_t retiredZones; //listed, but their pages went back to the system
+    size_t mappedBytes;  //large object mappings, shared by both heaps
+    size_t footprint;    //customHeapFootprint()
+} heapStats;
+
+//walks the single thread block list
+void customHeapStats(heapStats* stats);
+//walks every zone under its lock, one zone at a time
+void customMTHeapStats(heapStats* stats);
+
+/*=============================================================================
+* heap walks and snapshots
+=============================================================================*/
+#define HEAP_WALK_LIST -1   //zone of blocks on the single thread block list
+#define HEAP_WALK_MAPPED -2 //zone of large object mappings
+
+typedef struct heapBlockInfo{
+    void* block;  //the Block header, or the first byte of a zone's untouched tail
+    size_t size;  //payload bytes, or the tail length
+    bool free;
+    bool tail;    //never carved zone tail: no header, always free
+    int zone;     //position in the zone list, HEAP_WALK_LIST or HEAP_WALK_MAPPED
+} heapBlockInfo;
+
+//return false to stop the walk; the MT walk calls it under the zone lock, so it must not
+//call into the MT heap
+typedef bool (*heapWalkCallback)(const heapBlockInfo* info, void* ctx);
+
+//the single thread block list, then the large object mappings
+void customHeapWalk(heapWalkCallback callback, void* ctx);
+//every zone in list order, each under its lock only while it is walked, then the mappings
+void customMTHeapWalk(heapWalkCallback callback, void* ctx);
+
+//snapshot file: one header, then a record per zone (HEAP_SNAPSHOT_ZONE, MT only) followed by
+//a record per block of the walk, all in host byte order
+#define HEAP_SNAPSHOT_MAGIC "CHSNAP01"
+#define HEAP_SNAPSHOT_FREE 1u
+#define HEAP_SNAPSHOT_TAIL 2u
+#define HEAP_SNAPSHOT_ZONE 4u //address and size are the zone bounds
+
+typedef struct heapSnapshotHeader{
+    char magic[8];
+    uint32_t headerBytes; //sizeof(Block), for telling payload from overhead
+    uint32_t zones;
+    uint64_t footprint;
+} heapSnapshotHeader;
+
+typedef struct heapSnapshotRecord{
+    uint64_t address;
+    uint64_t size;
+    int32_t zone;
+    uint32_t flags;
+} heapSnapshotRecord;
+
+//writes the single thread heap (mt false) or the MT heap; 0 on success, -1 on a write error
+int customHeapSnapshot(FILE* out, bool mt);
+
+/*=============================================================================
+* copy and zero kernels
+=============================================================================*/
+typedef enum kernelLevel{
+    KERNEL_SCALAR, //memcpy and memset for every size
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+    KERNEL_LEVELS
+} kernelLevel;
+
+//moves this big go through the kernels and their stores bypass the cache, shorter ones
+//use memcpy and memset. a block this big would mostly push the rest of the heap out
+#define KERNEL_STREAM_BYTES (4 * 1024 * 1024)
+
+//the best level the CPU has, checked once at runtime, unless customSetKernelLevel picked another
+kernelLevel customKernelLevel();
+//-1 when the CPU lacks the level
+int customSetKernelLevel(kernelLevel level);
+
+/*=============================================================================
+* lifetime hints
+=============================================================================*/
+//every hint owns its own group of zones, blocks of different lifetimes never share a zone
+typedef enum allocHint{
+    DEFAULT_LIVED = 0, //customMTMalloc and friends
+    SHORT_LIVED,       //per request buffers: freed holes first, spread over the group's zones
+    LONG_LIVED,        //caches: packed from the group's oldest zone on, freed holes first
+    BULK,              //large buffers: fresh tail first
+    ALLOC_HINTS
+} allocHint;
+
+//zone states, written under zoneLock and read without it
+typedef enum zoneState{
+    ZONE_ACTIVE,
+    ZONE_DRAINING, //nearly empty: allocations go elsewhere first so it can drain
+    ZONE_RETIRED   //fully free, pages released; stays listed and is revived before the heap grows
+} zoneState;
+
+#define ZONE_DRAIN_FRACTION 8 //a zone with at most 1/8 of its bytes live is drained
+
+//zone metadata gets its own cache lines so one zone's lock traffic does not hit its neighbours
 typedef struct memZone{
     char*  startOfZone;
+    char*  endOfZone;
+    //the zone list covers [startOfZone, linkedEnd); blocks in [linkedEnd, bumpPtr) were bumped
+    //without a lock and get linked on the next locked walk; [bumpPtr, endOfZone) is untouched
+    char*  bumpPtr;     //moved by compare and swap only
+    char*  linkedEnd;
     pthread_mutex_t zoneLock;
-    size_t remainingSpace;
+    size_t remainingSpace; //free bytes in the zone list, the tail not included
     Block* zoneBlockList;
+    Block* largeFreeRoot;
+    size_t largestFree; //largest free block in the list, written under zoneLock, read without it
+    allocHint group;    //fixed when the zone is created
+    zoneState state;
+    fastBinSet fastBins; //under zoneLock
     struct memZone* next;
-} memZone;
+} __attribute__((aligned(CACHE_LINE_SIZE))) memZone;
+
+/*=============================================================================
+* per-CPU caches
+=============================================================================*/
+#define CPU_CACHE_CLASS_STEP 16
+#define CPU_CACHE_CLASSES 16 //classes of 16..256 bytes
+#define CPU_CACHE_DEPTH 32   //blocks kept per class per CPU
+
+//not lock-free: a thread can be moved to another CPU halfway through a push or pop, and
+//without restartable sequences only a lock makes that safe. each CPU's lock is its own, so it
+//is only contended when threads share a CPU or one migrates mid-operation
+typedef struct cpuCache{
+    pthread_mutex_t lock;
+    void* bins[CPU_CACHE_CLASSES];
+    int counts[CPU_CACHE_CLASSES];
+} __attribute__((aligned(CACHE_LINE_SIZE))) cpuCache;
+
+/*=============================================================================
+* arenas
+=============================================================================*/
+typedef struct arenaChunk{
+    struct arenaChunk* next;
+    size_t size; //usable bytes after the header
+    size_t used;
+} arenaChunk;
+
+typedef struct customArena{
+    arenaChunk* first;   //the arena itself lives at the start of the first chunk
+    arenaChunk* current;
+} customArena;
+
+/*=============================================================================
+* object pools
+=============================================================================*/
+#define POOL_PAGE_SIZE (64 * 1024)
+#define POOL_MAGAZINE_SIZE 32         //objects a thread keeps for one pool
+#define POOL_MAGAZINES_PER_THREAD 8   //pools a thread keeps magazines for
+
+typedef struct poolPage{
+    struct poolPage* next;
+    size_t size;
+} poolPage;
+
+typedef struct customPool{
+    pthread_mutex_t lock;
+    size_t objectSize;
+    size_t alignment;
+    size_t pageSize;
+    void* freeList;    //intrusive, the first word of a free object links the list
+    poolPage* pages;   //the pool itself lives in the last page of this list
+    char* carve;       //untouched part of the newest page
+    char* carveEnd;
+    unsigned long id;  //never reused, 0 marks an empty magazine
+    int magazines;     //thread magazines holding the pool, under lock
+    bool destroyed;    //the last magazine to let go unmaps the pool
+} customPool;
+
+typedef struct poolMagazine{
+    customPool* pool;
+    unsigned long poolId;
+    int count;
+    void* objs[POOL_MAGAZINE_SIZE];
+} poolMagazine;
+
+/*=============================================================================
+* deferred free
+=============================================================================*/
+#define DEFERRED_FREE_RING_SIZE 1024
+#define DEFERRED_FREE_INTERVAL_US 1000 //reclaim thread wakes up at least this often
+
+typedef struct deferredFreeRing{
+    size_t head __attribute__((aligned(CACHE_LINE_SIZE))); //moved by the freeing thread
+    size_t tail __attribute__((aligned(CACHE_LINE_SIZE))); //moved by the reclaim thread
+    struct deferredFreeRing* next;
+    bool orphaned; //its thread exited, the next thread that queues a free adopts it
+    bool pushing;  //its thread is inside deferredFreePush, turning deferred free off waits it out
+    void* slots[DEFERRED_FREE_RING_SIZE];
+} deferredFreeRing;
 
 extern Block* blockList;
+extern Block* largeFreeRoot;
+extern int num_of_zones;
+extern deferredFreeRing* deferredFreeRings;
+
+/*=============================================================================
+* cache line aware MT allocation
+=============================================================================*/
+//payload starts on a cache line and is padded to whole lines, so no other block shares them
+void* customMTMallocCacheAligned(size_t size);
+//when enabled, customMTMalloc behaves like customMTMallocCacheAligned
+void customMTSetCacheAligned(bool enable);
+
+//small customMTMalloc/customMTFree calls are served from a cache of the CPU the thread runs on,
+//behind a per-CPU mutex (see cpuCache); safe to toggle while other threads allocate
+void customMTEnablePerCPUCache(bool enable);
+
+//allocates from the zone group of the hint, freed with customMTFree like any other block
+void* customMTMallocHint(size_t size, allocHint hint);
+
+//when enabled customMTFree only queues the pointer; a reclaim thread started by heapCreate
+//(or here, when the heap already exists) frees the queued pointers in batches
+void customMTSetDeferredFree(bool enable);
+
+//retires fully free zones and marks nearly empty ones as draining, meant for idle time;
+//returns the bytes given back to the system
+size_t customMTHeapCompact();
+
+/*=============================================================================
+* single threaded fast path
+=============================================================================*/
+//true until a second thread has called the MT API; until then the MT calls take no locks
+bool customMTIsSingleThreaded();
+
+/*=============================================================================
+* arena API - bump allocation, everything is released at once
+=============================================================================*/
+customArena* customArenaCreate(size_t initial_size);
+void* customArenaAlloc(customArena* arena, size_t size);
+void customArenaReset(customArena* arena);
+void customArenaDestroy(customArena* arena);
+
+/*=============================================================================
+* object pool API - fixed size objects without a per-object header
+=============================================================================*/
+customPool* customPoolCreate(size_t object_size, size_t alignment);
+void* customPoolAlloc(customPool* pool);
+void customPoolFree(customPool* pool, void* ptr);
+void customPoolDestroy(customPool* pool);
+
+/*=============================================================================
+* sized free - the caller passes the size it allocated
+=============================================================================*/
+//with heapConfig.checkFreeSize a size that does not match the block header is reported and
+//the block is not freed. otherwise the single thread heap ignores the size, it is customFree
+void customFreeSized(void* ptr, size_t size);
+//the size picks the per-CPU cache bin without reading the class off the header
+void customMTFreeSized(void* ptr, size_t size);
+
+/*=============================================================================
+* batch API - one lock acquisition per zone for the whole batch
+=============================================================================*/
+//fills out[] and returns how many blocks were allocated (less than count when out of memory)
+size_t customMTMallocBatch(size_t size, size_t count, void** out);
+//ptrs[] is sorted in place
+void customMTFreeBatch(void** ptrs, size_t count);
+
+/*=============================================================================
+* usable size - the payload may be larger than requested
+=============================================================================*/
+size_t customMallocUsableSize(void* ptr);
+size_t customMTMallocUsableSize(void* ptr);
+//*actual receives the usable size of the returned block (0 on failure)
+void* customMTMallocAtLeast(size_t size, size_t* actual);
 
-//void initZoneMT(int index);
+void mtOpBegin();
+void mtOpEnd();
+int initZoneMT(memZone* zone, char* start, size_t size);
+void updateZoneSummaryMT(memZone* zone);
+void adoptZoneTailMT(memZone* zone);
+void freeIndexInsertIfLarge(Block** root, Block* block);
+void freeIndexRemoveIfLarge(Block** root, Block* block);
+Block* freeIndexBestFit(Block* root, size_t size);
 Block* findBestFit(size_t size);
 Block* findBestFitInZoneMT(memZone* zone, size_t size);
+Block* carveBlockInZoneMT(memZone* zone, size_t size, size_t alignment);
+void* sbrkAligned(size_t size);
+memZone* findZoneMT(void* ptr);
+void releaseBlockInZoneMT(memZone* zone, Block* prev, Block* block);
+void coalesceZoneMT(memZone* zone);
+void* mapChunk(size_t size);
 Block* requestSpace(Block* last, size_t size);
 Block* getBlock(void* ptr);
 Block* getAndValidateBlockReturnPrev(void* ptr);
-Block* getAndValidateBlockReturnPrevMT(void* ptr, Block* blockListInSpecificZone );
-memZone* create_new_zone();
+memZone* create_new_zone(allocHint group);
+bool isLargeObject(size_t size);
+void* mapLargeBlock(size_t size, size_t alignment);
+void* mapHugeAligned(size_t length);
+bool isMappedBlock(void* ptr);
+bool unmapLargeBlock(void* ptr);
+//calloc, realloc and zone setup move their bytes through these; dst and src never overlap
+void blockCopy(void* dst, const void* src, size_t n);
+void blockZero(void* dst, size_t n);
 
 
 #endif // CUSTOM_ALLOCATOR
@@ -0,0 +1,239 @@
+#include "customAllocator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*=============================================================================
+* renders a customHeapSnapshot file as a fragmentation map per zone and a size histogram
+* usage: heapview snapshot
+* map cells: '#' mostly allocated, '.' mostly free, '+' mixed, '_' untouched zone tail
+=============================================================================*/
+#define MAP_WIDTH 64
+#define HISTOGRAM_BUCKETS 21 //16 bytes up to 16 MiB and more
+#define BAR_WIDTH 40
+
+typedef struct region{
+    int zone;
+    uint64_t start;
+    uint64_t end;
+    uint64_t cells[MAP_WIDTH][3]; //allocated (headers included), free, tail bytes per cell
+    uint64_t largestFree;
+} region;
+
+typedef struct snapshot{
+    heapSnapshotHeader header;
+    heapSnapshotRecord* records;
+    size_t count;
+} snapshot;
+
+static int readSnapshot(const char* path, snapshot* snap) {
+    FILE* in = fopen(path, "rb");
+    if (in == NULL) {
+        perror(path);
+        return -1;
+    }
+    if (fread(&snap->header, sizeof(snap->header), 1, in) != 1 ||
+        memcmp(snap->header.magic, HEAP_SNAPSHOT_MAGIC, sizeof(snap->header.magic)) != 0) {
+        fprintf(stderr, "%s: not a heap snapshot\n", path);
+        fclose(in);
+        return -1;
+    }
+    size_t capacity = 1024;
+    snap->records = malloc(capacity * sizeof(heapSnapshotRecord));
+    snap->count = 0;
+    while (snap->records != NULL && fread(&snap->records[snap->count], sizeof(heapSnapshotRecord), 1, in) == 1) {
+        if (++snap->count == capacity) {
+            capacity *= 2;
+            snap->records = realloc(snap->records, capacity * sizeof(heapSnapshotRecord));
+        }
+    }
+    fclose(in);
+    if (snap->records == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+static region* findRegion(region* regions, size_t count, int zone) {
+    for (size_t i = 0; i < count; i++) {
+        if (regions[i].zone == zone) {
+            return &regions[i];
+        }
+    }
+    return NULL;
+}
+
+//spreads [start, end) of one kind over the cells it covers
+static void paint(region* r, uint64_t start, uint64_t end, int kind) {
+    uint64_t span = r->end - r->start;
+    while (start < end) {
+        size_t cell = (size_t)((start - r->start) * MAP_WIDTH / span);
+        cell = cell < MAP_WIDTH ? cell : MAP_WIDTH - 1;
+        uint64_t cellEnd = r->start + (span * (cell + 1) + MAP_WIDTH - 1) / MAP_WIDTH;
+        uint64_t stop = cellEnd < end && cell < MAP_WIDTH - 1 ? cellEnd : end;
+        r->cells[cell][kind] += stop - start;
+        start = stop;
+    }
+}
+
+static char cellGlyph(const uint64_t* cell) {
+    uint64_t carved = cell[0] + cell[1];
+    if (carved == 0) {
+        return cell[2] != 0 ? '_' : ' ';
+    }
+    if (cell[0] * 4 >= carved * 3) {
+        return '#';
+    }
+    if (cell[1] * 4 >= carved * 3) {
+        return '.';
+    }
+    return '+';
+}
+
+static int bucketOf(uint64_t size) {
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS - 1 && size >= (uint64_t)32 << bucket) {
+        bucket++;
+    }
+    return bucket;
+}
+
+static void printBar(uint64_t value, uint64_t max, char glyph) {
+    int width = max != 0 ? (int)((value * BAR_WIDTH + max - 1) / max) : 0;
+    for (int i = 0; i < width; i++) {
+        putchar(glyph);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s snapshot\n", argv[0]);
+        return 1;
+    }
+    snapshot snap;
+    if (readSnapshot(argv[1], &snap) != 0) {
+        return 1;
+    }
+    uint64_t headerBytes = snap.header.headerBytes;
+    size_t regionCapacity = snap.header.zones + 2;
+    region* regions = malloc(regionCapacity * sizeof(region));
+    size_t regionCount = 0;
+    //zone records give the bounds, the block list and zones added after the header get theirs from extents
+    for (size_t i = 0; i < snap.count; i++) {
+        heapSnapshotRecord* rec = &snap.records[i];
+        if (rec->zone == HEAP_WALK_MAPPED) {
+            continue;
+        }
+        uint64_t start = rec->address;
+        uint64_t end = rec->address + rec->size + (rec->flags & (HEAP_SNAPSHOT_ZONE | HEAP_SNAPSHOT_TAIL) ? 0 : headerBytes);
+        region* r = findRegion(regions, regionCount, rec->zone);
+        if (r == NULL) {
+            if (regionCount == regionCapacity) {
+                regionCapacity *= 2;
+                regions = realloc(regions, regionCapacity * sizeof(region));
+            }
+            if (regions == NULL) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            r = &regions[regionCount++];
+            memset(r, 0, sizeof(*r));
+            r->zone = rec->zone;
+            r->start = start;
+            r->end = end;
+        }
+        else if (!(rec->flags & HEAP_SNAPSHOT_ZONE)) {
+            r->start = start < r->start ? start : r->start;
+            r->end = end > r->end ? end : r->end;
+        }
+    }
+    uint64_t histogram[HISTOGRAM_BUCKETS][2] = {{0}};
+    uint64_t liveBytes = 0, liveBlocks = 0, freeBytes = 0, overhead = 0, largestFree = 0;
+    uint64_t mappedBytes = 0, mappedBlocks = 0;
+    for (size_t i = 0; i < snap.count; i++) {
+        heapSnapshotRecord* rec = &snap.records[i];
+        bool isFree = rec->flags & HEAP_SNAPSHOT_FREE;
+        if (rec->flags & HEAP_SNAPSHOT_ZONE) {
+            continue;
+        }
+        if (rec->zone == HEAP_WALK_MAPPED) {
+            mappedBytes += rec->size;
+            mappedBlocks++;
+            continue;
+        }
+        region* r = findRegion(regions, regionCount, rec->zone);
+        if (rec->flags & HEAP_SNAPSHOT_TAIL) {
+            paint(r, rec->address, rec->address + rec->size, 2);
+            freeBytes += rec->size;
+            r->largestFree = rec->size > r->largestFree ? rec->size : r->largestFree;
+            continue;
+        }
+        histogram[bucketOf(rec->size)][isFree]++;
+        overhead += headerBytes;
+        paint(r, rec->address, rec->address + headerBytes, 0);
+        paint(r, rec->address + headerBytes, rec->address + headerBytes + rec->size, isFree);
+        if (isFree) {
+            freeBytes += rec->size;
+            r->largestFree = rec->size > r->largestFree ? rec->size : r->largestFree;
+        }
+        else {
+            liveBytes += rec->size;
+            liveBlocks++;
+        }
+    }
+    printf("fragmentation map ('#' allocated, '.' free, '+' mixed, '_' untouched tail)\n");
+    for (size_t i = 0; i < regionCount; i++) {
+        region* r = &regions[i];
+        char map[MAP_WIDTH + 1];
+        for (int c = 0; c < MAP_WIDTH; c++) {
+            map[c] = cellGlyph(r->cells[c]);
+        }
+        map[MAP_WIDTH] = '\0';
+        largestFree = r->largestFree > largestFree ? r->largestFree : largestFree;
+        if (r->zone == HEAP_WALK_LIST) {
+            printf("list     %9llu B |%s| largest free %llu\n", (unsigned long long)(r->end - r->start), map,
+                   (unsigned long long)r->largestFree);
+        }
+        else {
+            printf("zone %3d %9llu B |%s| largest free %llu\n", r->zone, (unsigned long long)(r->end - r->start),
+                   map, (unsigned long long)r->largestFree);
+        }
+    }
+    printf("\nblock sizes          allocated       free\n");
+    uint64_t maxCount = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        uint64_t count = histogram[b][0] + histogram[b][1];
+        maxCount = count > maxCount ? count : maxCount;
+    }
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        if (histogram[b][0] + histogram[b][1] == 0) {
+            continue;
+        }
+        if (b == 0) {
+            printf("%9s < %8llu", "", 32ULL);
+        }
+        else if (b == HISTOGRAM_BUCKETS - 1) {
+            printf("%9llu+%10s", 16ULL << b, "");
+        }
+        else {
+            printf("%9llu - %8llu", 16ULL << b, (32ULL << b) - 1);
+        }
+        printf(" %10llu %10llu ", (unsigned long long)histogram[b][0], (unsigned long long)histogram[b][1]);
+        printBar(histogram[b][0], maxCount, '#');
+        printBar(histogram[b][1], maxCount, '.');
+        putchar('\n');
+    }
+    //share of free bytes that no single request of the largest free size could use
+    double fragmentation = freeBytes != 0 ? 1.0 - (double)largestFree / freeBytes : 0.0;
+    printf("\nlive_blocks=%llu live_bytes=%llu free_bytes=%llu header_bytes=%llu largest_free=%llu "
+           "fragmentation=%.2f mapped_blocks=%llu mapped_bytes=%llu footprint=%llu\n",
+           (unsigned long long)liveBlocks, (unsigned long long)liveBytes, (unsigned long long)freeBytes,
+           (unsigned long long)overhead, (unsigned long long)largestFree, fragmentation,
+           (unsigned long long)mappedBlocks, (unsigned long long)mappedBytes,
+           (unsigned long long)snap.header.footprint);
+    free(regions);
+    free(snap.records);
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <time.h>
 #include <stdint.h>
+#include <sys/mman.h>
 
 #define RED   "\x1B[31m"
 #define GRN   "\x1B[32m"
@@ -176,6 +177,35 @@ void test_comb(){
 
     printf(GRN "test_comb GOOD\n" RST);
 }
+void test_best_fit_large() {
+    /*
+        test the large free block index:
+        -best fit among large free blocks picks the smallest that fits
+        -equal sizes go to the lowest address
+    */
+    printf(YEL "\n--- Test: Best Fit Among Large Blocks ---\n" RST);
+    void* big = customMalloc(1000);
+    void* f1 = customMalloc(10);
+    void* low = customMalloc(600);
+    void* f2 = customMalloc(10);
+    void* high = customMalloc(600);
+    void* f3 = customMalloc(10);
+
+    customFree(high);
+    customFree(big);
+    customFree(low);
+
+    void* p = customMalloc(500);
+    if (p == low) {
+        printf(GRN "PASS: Best Fit picked the lowest of the closest large blocks.\n" RST);
+    } else {
+        printf(RED "FAIL: Expected %p, got %p\n" RST, low, p);
+    }
+    customFree(p);
+    customFree(f1);
+    customFree(f2);
+    customFree(f3);
+}
 void test_calloc_large() {
     /*
         use customCalloc to allocate a big buffer and make sure its all zeros
@@ -329,6 +359,40 @@ void test_realloc_variations_A() {
     printf(GRN "PASS: Big expansion preserved data.\n" RST);
     customFree(p3_new);
 }
+void* single_alloc_worker(void* arg) {
+    void* ptr = customMTMalloc(32);
+    customMTFree(ptr);
+    return arg;
+}
+void* single_cache_toggle_worker(void* arg) {
+    customMTEnablePerCPUCache(false);
+    return arg;
+}
+void test_mt_single_thread_fast_path() {
+    /*
+       test the single threaded fast path (must run before any other thread uses the MT API):
+       -a lone thread allocates without locks and its blocks stay valid
+       -once a second thread calls in, the MT API switches to locking for good
+       -turning the per-CPU cache off counts as calling in, its flush frees into the zones
+    */
+    printf(YEL "\n--- Test Part B: Single Threaded Fast Path ---\n" RST);
+    char* p1 = (char*)customMTMalloc(100);
+    memset(p1, 'S', 100);
+    int lone = customMTIsSingleThreaded();
+    pthread_t thread;
+    pthread_create(&thread, NULL, single_cache_toggle_worker, NULL);
+    pthread_join(thread, NULL);
+    int switched = !customMTIsSingleThreaded();
+    pthread_create(&thread, NULL, single_alloc_worker, NULL);
+    pthread_join(thread, NULL);
+    int intact = (p1[0] == 'S' && p1[99] == 'S');
+    customMTFree(p1);
+    if (lone && switched && intact) {
+        printf(GRN "PASS: Lock free while alone, locking after the second thread.\n" RST);
+    } else {
+        printf(RED "FAIL: Fast path state wrong (lone=%d, switched=%d, intact=%d)\n" RST, lone, switched, intact);
+    }
+}
 void* calloc_thread_worker(void* arg) {
     /*
        test customMTCalloc functionality
@@ -429,6 +493,30 @@ void test_mt_realloc_threaded() {
     }
     printf(GRN "PASS: MT Realloc threaded test completed successfully.\n" RST);
 }
+void test_mt_realloc_in_place() {
+    /*
+       test customMTRealloc resizing in place:
+       -a shrink keeps the pointer and gives the slack back to the zone
+       -growing over that freed slack keeps the pointer and the data
+    */
+    printf(YEL "\n--- Test Part B: MT Realloc In Place ---\n" RST);
+    unsigned char* ptr = customMTMalloc(200);
+    memset(ptr, 0x5a, 200);
+    unsigned char* shrunk = customMTRealloc(ptr, 40);
+    int shrinkOk = shrunk == ptr && customMTMallocUsableSize(shrunk) < 200;
+    unsigned char* grown = customMTRealloc(shrunk, 180);
+    int growOk = grown == ptr && customMTMallocUsableSize(grown) >= 180;
+    for (int i = 0; i < 40; i++) {
+        growOk = growOk && grown[i] == 0x5a;
+    }
+    customMTFree(grown);
+    if (shrinkOk && growOk) {
+        printf(GRN "PASS: MT realloc shrank and grew in place.\n" RST);
+    } else {
+        printf(RED "FAIL: MT realloc moved a block it could resize in place (shrink %d, grow %d).\n" RST,
+               shrinkOk, growOk);
+    }
+}
 void* stress_worker(void* arg) {
     /*
        create a lot of stress on the threads - multiple malloc and free
@@ -468,6 +556,923 @@ void test_mt_zone_overflow() {
     }
     printf(GRN "PASS: MT Stress test completed.\n" RST);
 }
+void test_mt_cache_aligned() {
+    /*
+       test customMTMallocCacheAligned / cache aligned mode:
+       -every payload starts on a cache line
+       -no two live allocations share a cache line
+    */
+    printf(YEL "\n--- Test Part B: Cache Line Aligned Allocation ---\n" RST);
+    void* ptrs[8];
+    size_t sizes[8] = {1, 10, 63, 64, 65, 100, 7, 200};
+    int ok = 1;
+    for (int i = 0; i < 8; i++) {
+        if (i < 4) {
+            ptrs[i] = customMTMallocCacheAligned(sizes[i]);
+        } else {
+            customMTSetCacheAligned(true);
+            ptrs[i] = customMTMalloc(sizes[i]);
+            customMTSetCacheAligned(false);
+        }
+        if (!ptrs[i] || (uintptr_t)ptrs[i] % 64 != 0) ok = 0;
+    }
+    for (int i = 0; ok && i < 8; i++) {
+        for (int j = 0; j < 8; j++) {
+            if (i == j) continue;
+            uintptr_t lastLine = ((uintptr_t)ptrs[i] + sizes[i] - 1) / 64;
+            if ((uintptr_t)ptrs[j] / 64 <= lastLine && (uintptr_t)ptrs[j] >= (uintptr_t)ptrs[i]) ok = 0;
+        }
+    }
+    for (int i = 0; i < 8; i++) customMTFree(ptrs[i]);
+    if (ok) {
+        printf(GRN "PASS: Cache aligned blocks start on their own cache lines.\n" RST);
+    } else {
+        printf(RED "FAIL: Cache aligned allocation shares or misses a cache line.\n" RST);
+    }
+}
+void test_mt_per_cpu_cache() {
+    /*
+       test the per-CPU cache front end:
+       -a freed small block is handed back by the next malloc of the same class on the same CPU
+       -threaded calloc/free stress with the cache on
+    */
+    printf(YEL "\n--- Test Part B: Per-CPU Cache ---\n" RST);
+    customMTEnablePerCPUCache(true);
+    void* p1 = customMTMalloc(40);
+    //a block whose slack was too small to split off is cached in the class of its full size
+    size_t classTop = customMTMallocUsableSize(p1) / CPU_CACHE_CLASS_STEP * CPU_CACHE_CLASS_STEP;
+    customMTFree(p1);
+    void* p2 = customMTMalloc(classTop - 4);
+    if (p2 == p1) {
+        printf(GRN "PASS: Freed block reused from the CPU cache.\n" RST);
+    } else {
+        printf(YEL "WARN: Block not reused (thread migrated between CPUs?).\n" RST);
+    }
+    customMTFree(p2);
+    pthread_t threads[THREAD_COUNT];
+    for (long i = 0; i < THREAD_COUNT; i++) {
+        pthread_create(&threads[i], NULL, calloc_thread_worker, (void*)i);
+    }
+    for (long i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    customMTEnablePerCPUCache(false);
+    printf(GRN "PASS: Per-CPU cache threaded test completed successfully.\n" RST);
+}
+void test_arena() {
+    /*
+       test the arena API:
+       -allocations spill over into new chunks and keep their data
+       -reset hands out the same memory again
+    */
+    printf(YEL "\n--- Test: Arena Allocation ---\n" RST);
+    customArena* arena = customArenaCreate(1024);
+    if (!arena) { printf(RED "FAIL: customArenaCreate returned NULL\n" RST); return; }
+    int* first = NULL;
+    int* objs[100];
+    for (int i = 0; i < 100; i++) {
+        objs[i] = (int*)customArenaAlloc(arena, 100);
+        if (!objs[i]) { printf(RED "FAIL: customArenaAlloc returned NULL\n" RST); return; }
+        if (!is_aligned(objs[i])) { printf(RED "FAIL: arena pointer not aligned\n" RST); return; }
+        *objs[i] = i;
+        if (i == 0) first = objs[i];
+    }
+    for (int i = 0; i < 100; i++) assert(*objs[i] == i);
+    void* big = customArenaAlloc(arena, 1 << 20);
+    if (!big) { printf(RED "FAIL: large arena allocation failed\n" RST); return; }
+    memset(big, 1, 1 << 20);
+    customArenaReset(arena);
+    int* again = (int*)customArenaAlloc(arena, 100);
+    if (again == first) {
+        printf(GRN "PASS: Arena reset reuses its memory.\n" RST);
+    } else {
+        printf(RED "FAIL: Arena reset did not rewind (first: %p, again: %p)\n" RST, (void*)first, (void*)again);
+    }
+    for (int i = 0; i < 100; i++) customArenaAlloc(arena, 100);
+    customArenaDestroy(arena);
+}
+customPool* shared_pool;
+void* pool_thread_worker(void* arg) {
+    /*
+       allocate and free from a shared pool, other threads' objects must stay intact
+    */
+    long id = (long)arg;
+    long* objs[64];
+    for (int round = 0; round < 50; round++) {
+        for (int i = 0; i < 64; i++) {
+            objs[i] = (long*)customPoolAlloc(shared_pool);
+            if (!objs[i]) { printf(RED "Thread %ld: customPoolAlloc returned NULL\n" RST, id); exit(1); }
+            objs[i][0] = id;
+            objs[i][5] = i;
+        }
+        for (int i = 0; i < 64; i++) {
+            if (objs[i][0] != id || objs[i][5] != i) {
+                printf(RED "Thread %ld: pool object corrupted\n" RST, id);
+                exit(1);
+            }
+            customPoolFree(shared_pool, objs[i]);
+        }
+    }
+    return NULL;
+}
+void test_pool() {
+    /*
+       test the object pool API:
+       -objects are aligned, distinct and span several pages
+       -freed objects are reused
+       -threaded alloc/free through the magazines
+    */
+    printf(YEL "\n--- Test: Object Pool ---\n" RST);
+    customPool* pool = customPoolCreate(48, 16);
+    if (!pool) { printf(RED "FAIL: customPoolCreate returned NULL\n" RST); return; }
+    int count = 4000; // more than one 64 KiB page
+    char** objs = (char**)malloc(count * sizeof(char*));
+    int ok = 1;
+    for (int i = 0; i < count; i++) {
+        objs[i] = (char*)customPoolAlloc(pool);
+        if (!objs[i] || (uintptr_t)objs[i] % 16 != 0) { ok = 0; break; }
+        memset(objs[i], i & 0xff, 48);
+    }
+    for (int i = 0; ok && i < count; i++) {
+        if ((unsigned char)objs[i][47] != (i & 0xff)) ok = 0;
+    }
+    void* last = objs[count - 1];
+    for (int i = 0; ok && i < count; i++) customPoolFree(pool, objs[i]);
+    void* again = customPoolAlloc(pool);
+    if (ok && again == last) {
+        printf(GRN "PASS: Pool objects aligned, intact and reused.\n" RST);
+    } else {
+        printf(RED "FAIL: Pool allocation misbehaved (ok=%d, last=%p, again=%p)\n" RST, ok, last, again);
+    }
+    free(objs);
+    customPoolDestroy(pool);
+
+    shared_pool = customPoolCreate(48, 8);
+    pthread_t threads[8];
+    for (long i = 0; i < 8; i++) {
+        pthread_create(&threads[i], NULL, pool_thread_worker, (void*)i);
+    }
+    for (long i = 0; i < 8; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    customPoolDestroy(shared_pool);
+    printf(GRN "PASS: Pool threaded test completed successfully.\n" RST);
+}
+void test_sized_free() {
+    /*
+       test customFreeSized / customMTFreeSized:
+       -sized free releases the block like the plain free
+       -with the per-CPU cache on the block goes straight back to its class
+       -with checkFreeSize a wrong size is caught and the block stays allocated
+    */
+    printf(YEL "\n--- Test: Sized Free ---\n" RST);
+    void* p1 = customMalloc(100);
+    void* p2 = customMalloc(100);
+    customFreeSized(p1, 100);
+    void* p3 = customMalloc(100);
+    int ok = (p3 == p1);
+    customFreeSized(p3, 100);
+    customFreeSized(p2, 100);
+
+    customMTEnablePerCPUCache(true);
+    void* m1 = customMTMalloc(70);
+    customMTFreeSized(m1, 70);
+    void* m2 = customMTMalloc(80);
+    if (m2 != m1) printf(YEL "WARN: Sized MT free did not hit the CPU cache.\n" RST);
+    customMTFreeSized(m2, 80);
+    customMTEnablePerCPUCache(false);
+    void* m3 = customMTMalloc(24);
+    customMTFreeSized(m3, 24);
+
+    heapConf.checkFreeSize = true;
+    void* wrong = customMalloc(300);
+    customFreeSized(wrong, 8);
+    int caught = !getBlock(wrong)->free && !getBlock(wrong)->binned;
+    customFreeSized(wrong, 300);
+    void* mtWrong = customMTMalloc(300);
+    customMTFreeSized(mtWrong, 8);
+    caught = caught && !getBlock(mtWrong)->free && !getBlock(mtWrong)->binned;
+    customMTFreeSized(mtWrong, 300);
+    heapConf.checkFreeSize = false;
+    if (caught) {
+        printf(GRN "PASS: Checked sized free caught a wrong size.\n" RST);
+    } else {
+        printf(RED "FAIL: Checked sized free freed a block of another size.\n" RST);
+    }
+
+    if (ok) {
+        printf(GRN "PASS: Sized free released and reused blocks.\n" RST);
+    } else {
+        printf(RED "FAIL: customFreeSized block was not reused (p1: %p, p3: %p)\n" RST, p1, p3);
+    }
+}
+void test_mt_batch() {
+    /*
+       test customMTMallocBatch / customMTFreeBatch:
+       -all requested blocks are handed out, aligned and non-overlapping
+       -after the batch free the same memory is handed out again, no zone is added
+    */
+    printf(YEL "\n--- Test Part B: Batch Malloc/Free ---\n" RST);
+    enum { BATCH = 300 };
+    void* ptrs[BATCH];
+    size_t got = customMTMallocBatch(40, BATCH, ptrs);
+    if (got != BATCH) { printf(RED "FAIL: batch returned %zu of %d blocks\n" RST, got, BATCH); return; }
+    for (int i = 0; i < BATCH; i++) {
+        assert(is_aligned(ptrs[i]));
+        memset(ptrs[i], i & 0xff, 40);
+    }
+    int ok = 1;
+    for (int i = 0; i < BATCH; i++) {
+        if (((unsigned char*)ptrs[i])[0] != (i & 0xff) || ((unsigned char*)ptrs[i])[39] != (i & 0xff)) ok = 0;
+    }
+    int zones = num_of_zones;
+    customMTFreeBatch(ptrs, BATCH);
+    void* again[BATCH];
+    got = customMTMallocBatch(40, BATCH, again);
+    int reused = (got == BATCH && num_of_zones == zones);
+    customMTFreeBatch(again, got);
+    if (ok && reused) {
+        printf(GRN "PASS: Batch blocks intact and reused after batch free.\n" RST);
+    } else {
+        printf(RED "FAIL: Batch allocation misbehaved (intact=%d, reused=%d)\n" RST, ok, reused);
+    }
+}
+void test_usable_size() {
+    /*
+       test customMallocUsableSize / customMTMallocUsableSize / customMTMallocAtLeast:
+       -the usable size covers the request and the alignment round up
+       -the whole usable size can be written, realloc to it keeps the pointer
+    */
+    printf(YEL "\n--- Test: Usable Size ---\n" RST);
+    char* p1 = (char*)customMalloc(5);
+    size_t usable = customMallocUsableSize(p1);
+    memset(p1, 'x', usable);
+    char* p2 = (char*)customRealloc(p1, usable);
+    int ok = (usable >= 8 && p2 == p1);
+    customFree(p2);
+
+    size_t actual = 0;
+    char* m1 = (char*)customMTMallocAtLeast(13, &actual);
+    if (!m1 || actual < 16 || actual != customMTMallocUsableSize(m1)) ok = 0;
+    if (m1) memset(m1, 'y', actual);
+    customMTFree(m1);
+    if (ok) {
+        printf(GRN "PASS: Usable size reported and writable.\n" RST);
+    } else {
+        printf(RED "FAIL: Usable size wrong (usable=%zu, actual=%zu)\n" RST, usable, actual);
+    }
+}
+void test_mt_zone_selection() {
+    /*
+       test load aware zone selection:
+       -blocks that only fit in an empty zone go to existing empty zones before new ones are made
+    */
+    printf(YEL "\n--- Test Part B: Load Aware Zone Selection ---\n" RST);
+    int zones = num_of_zones;
+    void* blocks[8];
+    for (int i = 0; i < 8; i++) {
+        blocks[i] = customMTMalloc(3000);
+    }
+    int grown = num_of_zones - zones;
+    for (int i = 0; i < 8; i++) {
+        customMTFree(blocks[i]);
+    }
+    if (grown == 0) {
+        printf(GRN "PASS: Large blocks placed in existing zones.\n" RST);
+    } else {
+        printf(RED "FAIL: %d zones created while free zones existed\n" RST, grown);
+    }
+}
+void* burst_worker(void* arg) {
+    /*
+       allocate a burst of fresh blocks, check them and free them
+    */
+    long id = (long)arg;
+    unsigned char* ptrs[100];
+    for (int i = 0; i < 100; i++) {
+        ptrs[i] = (unsigned char*)customMTMalloc(48);
+        if (ptrs[i]) memset(ptrs[i], (int)id, 48);
+    }
+    for (int i = 0; i < 100; i++) {
+        if (!ptrs[i]) continue;
+        if (ptrs[i][0] != (unsigned char)id || ptrs[i][47] != (unsigned char)id) {
+            printf(RED "Thread %ld: MEMORY CORRUPTION DETECTED!\n" RST, id);
+        }
+        customMTFree(ptrs[i]);
+    }
+    return NULL;
+}
+void test_mt_bump_tail() {
+    /*
+       test bump allocation from fresh zone tails:
+       -a batch from a fresh tail is one contiguous run
+       -a threaded burst of fresh allocations stays intact and is freed back
+    */
+    printf(YEL "\n--- Test Part B: Zone Tail Bump Allocation ---\n" RST);
+    void* run[16];
+    size_t got = customMTMallocBatch(32, 16, run);
+    int contiguous = 0;
+    for (size_t i = 1; i < got; i++) {
+        if ((char*)run[i] == (char*)run[i - 1] + 32 + sizeof(Block)) contiguous++;
+    }
+    customMTFreeBatch(run, got);
+    pthread_t threads[8];
+    for (long i = 0; i < 8; i++) {
+        pthread_create(&threads[i], NULL, burst_worker, (void*)i);
+    }
+    for (long i = 0; i < 8; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    if (got == 16 && contiguous >= 14) {
+        printf(GRN "PASS: Fresh tail handed out back to back, burst intact.\n" RST);
+    } else {
+        printf(RED "FAIL: Tail blocks not contiguous (%d of %zu)\n" RST, contiguous, got);
+    }
+}
+void test_mt_deferred_free() {
+    /*
+       test deferred free:
+       -freed pointers are queued and released by the reclaim thread
+       -turning it off drains every queue
+       -threaded calloc/free stress with deferred free on
+    */
+    printf(YEL "\n--- Test Part B: Deferred Free ---\n" RST);
+    customMTSetDeferredFree(true);
+    void* ptrs[64];
+    for (int i = 0; i < 64; i++) {
+        ptrs[i] = customMTMalloc(24);
+    }
+    for (int i = 0; i < 64; i += 2) {
+        customMTFree(ptrs[i]);
+    }
+    customMTSetDeferredFree(false);
+    int released = 1;
+    for (int i = 0; i < 64; i += 2) {
+        if (!getBlock(ptrs[i])->free) released = 0;
+    }
+    for (int i = 1; i < 64; i += 2) {
+        customMTFree(ptrs[i]);
+    }
+    customMTSetDeferredFree(true);
+    pthread_t threads[THREAD_COUNT];
+    for (long i = 0; i < THREAD_COUNT; i++) {
+        pthread_create(&threads[i], NULL, calloc_thread_worker, (void*)i);
+    }
+    for (long i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    customMTSetDeferredFree(false);
+    if (released) {
+        printf(GRN "PASS: Deferred frees released by the reclaim thread.\n" RST);
+    } else {
+        printf(RED "FAIL: Deferred frees still pending after drain.\n" RST);
+    }
+}
+customPool* churn_pool = NULL;
+void* churn_worker(void* arg) {
+    /*
+       one short lived pool worker: a few pool objects and a few deferred frees, then exit
+    */
+    void* objs[16];
+    for (int i = 0; i < 16; i++) {
+        objs[i] = customPoolAlloc(churn_pool);
+    }
+    for (int i = 0; i < 16; i++) {
+        customPoolFree(churn_pool, objs[i]);
+        customMTFree(customMTMalloc(32));
+    }
+    return arg;
+}
+void test_thread_churn() {
+    /*
+       test that exiting threads hand their per-thread state back:
+       -pool objects cached in a dead thread's magazine return to the pool
+       -a dead thread's deferred free ring is adopted instead of mapping a new one
+    */
+    printf(YEL "\n--- Test Part B: Thread Churn ---\n" RST);
+    churn_pool = customPoolCreate(2048, 8); //32 objects to a page
+    customMTSetDeferredFree(true);
+    int ringsBefore = 0, rings = 0, pages = 0;
+    for (deferredFreeRing* ring = deferredFreeRings; ring != NULL; ring = ring->next) ringsBefore++;
+    for (int i = 0; i < 64; i++) {
+        pthread_t worker;
+        pthread_create(&worker, NULL, churn_worker, NULL);
+        pthread_join(worker, NULL);
+    }
+    customMTSetDeferredFree(false);
+    for (deferredFreeRing* ring = deferredFreeRings; ring != NULL; ring = ring->next) rings++;
+    for (poolPage* page = churn_pool->pages; page != NULL; page = page->next) pages++;
+    customPoolDestroy(churn_pool);
+    if (rings <= ringsBefore + 1 && pages <= 2) {
+        printf(GRN "PASS: 64 worker generations reused one ring and %d pool pages.\n" RST, pages);
+    } else {
+        printf(RED "FAIL: Worker churn kept growing (rings %d -> %d, pool pages %d).\n" RST,
+               ringsBefore, rings, pages);
+    }
+}
+void test_mt_lifetime_hints() {
+    /*
+       test lifetime hints:
+       -every hint lands in a zone of its own group
+       -a freed short lived block is reused before fresh tail
+       -a sized free keeps hinted blocks out of the default allocations
+    */
+    printf(YEL "\n--- Test Part B: Lifetime Hints ---\n" RST);
+    void* plain = customMTMalloc(40);
+    void* shortLived = customMTMallocHint(40, SHORT_LIVED);
+    void* longLived = customMTMallocHint(40, LONG_LIVED);
+    void* bulk = customMTMallocHint(1024, BULK);
+    int grouped = findZoneMT(plain)->group == DEFAULT_LIVED &&
+                  findZoneMT(shortLived)->group == SHORT_LIVED &&
+                  findZoneMT(longLived)->group == LONG_LIVED &&
+                  findZoneMT(bulk)->group == BULK;
+    void* next = customMTMallocHint(40, SHORT_LIVED);
+    customMTFree(shortLived);
+    void* again = customMTMallocHint(40, SHORT_LIVED);
+    if (grouped) {
+        printf(GRN "PASS: Every hint allocates from its own zone group.\n" RST);
+    } else {
+        printf(RED "FAIL: Hinted block landed in a foreign zone group.\n" RST);
+    }
+    if (again == shortLived) {
+        printf(GRN "PASS: Freed short lived block reused first.\n" RST);
+    } else {
+        printf(RED "FAIL: Short lived allocation skipped a freed hole.\n" RST);
+    }
+    customMTEnablePerCPUCache(true);
+    void* sized = customMTMallocHint(64, LONG_LIVED);
+    customMTFreeSized(sized, 64);
+    void* plainAgain = customMTMalloc(64);
+    customMTEnablePerCPUCache(false);
+    if (findZoneMT(plainAgain)->group == DEFAULT_LIVED) {
+        printf(GRN "PASS: Sized free of a hinted block stays in its group.\n" RST);
+    } else {
+        printf(RED "FAIL: Sized free handed a long lived block to customMTMalloc.\n" RST);
+    }
+    customMTFree(plainAgain);
+    customMTFree(plain);
+    customMTFree(again);
+    customMTFree(next);
+    customMTFree(longLived);
+    customMTFree(bulk);
+}
+void test_heap_config() {
+    /*
+       test heap configuration:
+       -CUSTOM_MALLOC_CONF fills a heapConfig
+       -the heap gets the configured zone count and size, zones double when they grow
+       -requests over the large object threshold are mapped on their own
+       -a bad entry is dropped, heapCreate still builds a heap around it
+       -sizes that wrap when rounded or multiplied are refused, counts are not cut down to an int
+    */
+    printf(YEL "\n--- Test Part B: Heap Configuration ---\n" RST);
+    setenv("CUSTOM_MALLOC_CONF", "zones:2,zone_size:16k,growth:double,max_zone_size:64k,large_threshold:8k", 1);
+    heapConfig config = HEAP_CONFIG_DEFAULT;
+    int parsed = heapConfigFromEnv(&config);
+    unsetenv("CUSTOM_MALLOC_CONF");
+    if (parsed == 0 && config.initialZones == 2 && config.zoneSize == 16 * 1024 &&
+        config.growth == ZONE_GROWTH_DOUBLE && config.maxZoneSize == 64 * 1024 &&
+        config.largeObjectThreshold == 8 * 1024) {
+        printf(GRN "PASS: CUSTOM_MALLOC_CONF parsed.\n" RST);
+    } else {
+        printf(RED "FAIL: CUSTOM_MALLOC_CONF parsed wrong.\n" RST);
+    }
+
+    heapKill();
+    if (customHeapCreateWithConfig(&config) != 0) {
+        printf(RED "FAIL: Configured heap rejected.\n" RST);
+        heapCreate();
+        return;
+    }
+    void* blocks[24];
+    int grew = 0;
+    int zoneCount = num_of_zones;
+    for (int i = 0; i < 24; i++) {
+        blocks[i] = customMTMalloc(3000);
+        memZone* zone = findZoneMT(blocks[i]);
+        if (zone != NULL && zone->endOfZone - zone->startOfZone == 32 * 1024) grew = 1;
+    }
+    if (zoneCount == 2 && grew) {
+        printf(GRN "PASS: Configured zone count and doubling growth.\n" RST);
+    } else {
+        printf(RED "FAIL: Zones do not follow the configuration.\n" RST);
+    }
+    void* big = customMTMalloc(10000);
+    int mapped = big != NULL && findZoneMT(big) == NULL && customMTMallocUsableSize(big) >= 10000;
+    if (mapped) memset(big, 0xAB, 10000);
+    customMTFree(big);
+    for (int i = 0; i < 24; i++) {
+        customMTFree(blocks[i]);
+    }
+    if (mapped) {
+        printf(GRN "PASS: Large object mapped outside the zones.\n" RST);
+    } else {
+        printf(RED "FAIL: Large object not mapped.\n" RST);
+    }
+    heapKill();
+    setenv("CUSTOM_MALLOC_CONF", "zones:0,zone_size:8k,zone_size:16,zone_size:20000000000g,zone_size:-8k,"
+           "zones:4294967297,zone_size:18446744073709551615", 1);
+    heapConfig defaults = HEAP_CONFIG_DEFAULT;
+    heapConfig dropped = HEAP_CONFIG_DEFAULT;
+    int rejected = heapConfigFromEnv(&dropped) != 0 && dropped.initialZones == defaults.initialZones &&
+                   dropped.zoneSize == 8 * 1024;
+    heapConfig overflowing = HEAP_CONFIG_DEFAULT;
+    overflowing.zoneSize = SIZE_MAX - 8;
+    rejected = rejected && customHeapCreateWithConfig(&overflowing) != 0;
+    overflowing.zoneSize = SIZE_MAX / 4;
+    overflowing.initialZones = 8;
+    rejected = rejected && customHeapCreateWithConfig(&overflowing) != 0;
+    heapCreate();
+    unsetenv("CUSTOM_MALLOC_CONF");
+    void* survivor = customMTMalloc(100);
+    if (rejected && survivor != NULL) {
+        printf(GRN "PASS: Bad configuration entries dropped, the heap still comes up.\n" RST);
+    } else {
+        printf(RED "FAIL: Bad configuration entries (rejected %d, block %p).\n" RST, rejected, survivor);
+    }
+    customMTFree(survivor);
+    heapKill();
+    heapCreate();
+}
+static void* lowMemorySpare = NULL;
+static int lowMemoryCalls = 0;
+static void release_spare(size_t requested) {
+    (void)requested;
+    lowMemoryCalls++;
+    if (lowMemorySpare != NULL) {
+        customMTFree(lowMemorySpare);
+        lowMemorySpare = NULL;
+    }
+}
+void test_memory_budget() {
+    /*
+       test the memory budget:
+       -allocations past the budget return NULL instead of exiting
+       -the low memory handler runs first and what it frees is used
+       -the footprint never passes the budget
+       -arenas count against the budget too
+       -shrinking a block in place needs nothing from an exhausted budget
+    */
+    printf(YEL "\n--- Test Part B: Memory Budget ---\n" RST);
+    heapKill();
+    heapConfig config = HEAP_CONFIG_DEFAULT;
+    config.memoryBudget = customHeapFootprint() + 12 * (sizeof(memZone) + config.zoneSize);
+    config.trimThreshold = 0; //the single heap blocks below go back, later tests expect it empty
+    if (customHeapCreateWithConfig(&config) != 0) {
+        printf(RED "FAIL: Budgeted heap rejected.\n" RST);
+        heapCreate();
+        return;
+    }
+    customSetLowMemoryHandler(release_spare);
+    lowMemorySpare = customMTMalloc(3000);
+    char* shrunk = customMalloc(200);
+    void* blocks[64];
+    int count = 0;
+    while (count < 64 && (blocks[count] = customMTMalloc(3000)) != NULL) {
+        count++;
+    }
+    int withinBudget = customHeapFootprint() <= config.memoryBudget;
+    customArena* overBudget = customArenaCreate(config.memoryBudget);
+    if (overBudget != NULL) {
+        customArenaDestroy(overBudget);
+    }
+    void* small[256];
+    int smallCount = 0;
+    while (smallCount < 256 && (small[smallCount] = customMalloc(200)) != NULL) {
+        smallCount++;
+    }
+    memset(shrunk, 0x3c, 200);
+    int shrunkInPlace = smallCount < 256 && customRealloc(shrunk, 180) == shrunk && shrunk[179] == 0x3c;
+    if (count < 64 && lowMemoryCalls > 0 && lowMemorySpare == NULL && withinBudget) {
+        printf(GRN "PASS: Budget exhausted gracefully after the low memory handler ran.\n" RST);
+    } else {
+        printf(RED "FAIL: Budget not enforced (count %d, handler calls %d).\n" RST, count, lowMemoryCalls);
+    }
+    if (overBudget == NULL) {
+        printf(GRN "PASS: Arena past the budget refused.\n" RST);
+    } else {
+        printf(RED "FAIL: Arena mapped past the budget.\n" RST);
+    }
+    if (shrunkInPlace) {
+        printf(GRN "PASS: Realloc shrinks in place with the budget exhausted.\n" RST);
+    } else {
+        printf(RED "FAIL: Realloc shrink with the budget exhausted (small blocks %d).\n" RST, smallCount);
+    }
+    for (int i = smallCount - 1; i >= 0; i--) {
+        customFree(small[i]);
+    }
+    customFree(shrunk);
+    for (int i = 0; i < count; i++) {
+        customMTFree(blocks[i]);
+    }
+    customSetLowMemoryHandler(NULL);
+    heapKill();
+    heapCreate();
+}
+void test_huge_pages() {
+    /*
+       test huge page mode:
+       -zones are carved from 2 MiB aligned regions advised for huge pages
+       -large objects past 2 MiB get a huge page mapping of their own
+       -heapKill gives the regions back
+    */
+    printf(YEL "\n--- Test Part B: Huge Pages ---\n" RST);
+    heapKill();
+    heapConfig config = HEAP_CONFIG_DEFAULT;
+    config.hugePages = true;
+    config.zoneSize = 64 * 1024;
+    if (customHeapCreateWithConfig(&config) != 0) {
+        printf(RED "FAIL: Huge page heap rejected.\n" RST);
+        heapCreate();
+        return;
+    }
+    void* small = customMTMalloc(64);
+    void* big = customMTMalloc(3 * 1024 * 1024);
+    memset(big, 1, 3 * 1024 * 1024);
+    hugePageStats stats;
+    int ok = customHugePageStats(&stats) == 0 && stats.reservedBytes >= 3 * (size_t)HUGE_PAGE_SIZE &&
+             stats.hugeBytes <= stats.residentBytes && small != NULL &&
+             ((uintptr_t)getBlock(big) & ~(uintptr_t)4095) % HUGE_PAGE_SIZE == 0;
+    customMTFree(small);
+    customMTFree(big);
+    heapKill();
+    hugePageStats after;
+    customHugePageStats(&after);
+    if (ok && after.reservedBytes == 0) {
+        printf(GRN "PASS: Zones and large objects in huge page regions (%zu of %zu KiB huge).\n" RST,
+               stats.hugeBytes / 1024, stats.residentBytes / 1024);
+    } else {
+        printf(RED "FAIL: Huge page regions not set up or not released.\n" RST);
+    }
+    heapCreate();
+}
+void test_heap_stats() {
+    /*
+       test heap statistics:
+       -live blocks and bytes follow allocations
+       -a freed block turns into free bytes, the zone count matches the heap
+    */
+    printf(YEL "\n--- Test Part B: Heap Statistics ---\n" RST);
+    heapStats before, during, after;
+    customMTHeapStats(&before);
+    void* a = customMTMalloc(100);
+    void* b = customMTMalloc(200);
+    customMTHeapStats(&during);
+    customMTFree(a);
+    customMTHeapStats(&after);
+    int ok = during.liveBlocks == before.liveBlocks + 2 && during.liveBytes >= before.liveBytes + 300 &&
+             after.liveBlocks == during.liveBlocks - 1 && during.zones == (size_t)num_of_zones &&
+             during.headerBytes >= during.liveBlocks * sizeof(Block);
+    customMTFree(b);
+    if (ok) {
+        printf(GRN "PASS: Heap statistics track live, free and header bytes.\n" RST);
+    } else {
+        printf(RED "FAIL: Heap statistics out of step with the heap.\n" RST);
+    }
+}
+void test_fast_bins() {
+    /*
+       test deferred coalescing:
+       -a freed small block comes straight back for the same size
+       -freeing a binned block again is caught, the bin does not hand it out twice
+       -a miss merges the binned neighbours back into one block
+    */
+    printf(YEL "\n--- Test: Fast Bins ---\n" RST);
+    void* a = customMalloc(40);
+    void* b = customMalloc(40);
+    void* c = customMalloc(40);
+    void* guard = customMalloc(40);
+    customFree(b);
+    int reused = customMalloc(40) == b;
+    customFree(b);
+    customFree(b); //double free
+    void* x = customMalloc(40);
+    void* y = customMalloc(40);
+    int doubleCaught = x == b && y != b;
+    customFree(y);
+    customFree(a);
+    customFree(x);
+    customFree(c);
+    void* merged = customMalloc(3 * 40);
+    customFree(merged);
+    customFree(guard);
+    void* m1 = customMTMalloc(40);
+    void* m2 = customMTMalloc(40);
+    customMTFree(m1);
+    customMTFree(m1); //double free
+    void* m3 = customMTMalloc(40);
+    void* m4 = customMTMalloc(40);
+    int mtDoubleCaught = m3 != m4;
+    customMTFree(m2);
+    customMTFree(m3);
+    customMTFree(m4);
+    if (reused && doubleCaught && merged == a && mtDoubleCaught) {
+        printf(GRN "PASS: Fast bins reuse, catch double frees and consolidate on a miss.\n" RST);
+    } else {
+        printf(RED "FAIL: Fast bins (reuse %d, double free %d/%d, merged %p vs %p).\n" RST,
+               reused, doubleCaught, mtDoubleCaught, merged, a);
+    }
+}
+void test_hardened_free() {
+    /*
+       test O(1) pointer checks:
+       -a pointer into the middle of a block is not freed
+       -a header overwritten by an overflow fails its seal
+       -a write after free over a fast bin link is caught, malloc does not follow it
+    */
+    printf(YEL "\n--- Test: Hardened Free ---\n" RST);
+    char* p = customMalloc(200);
+    char* q = customMalloc(200);
+    void* guard = customMalloc(200);
+    memset(p, 0x5c, 200);
+    customFree(p + 48); //interior pointer
+    int interiorCaught = !getBlock(p)->free;
+    getBlock(q)->size += 8; //overflow into the header
+    customFree(q);
+    int overflowCaught = !getBlock(q)->free;
+    getBlock(q)->size -= 8;
+    customFree(q);
+    customFree(p);
+    void* a = customMalloc(40);
+    void* b = customMalloc(40);
+    void* fence = customMalloc(40);
+    customFree(a);
+    customFree(b);
+    *(void**)b = (void*)0x4141414141414141ULL; //write after free over the bin link
+    void* r = customMalloc(40);
+    int linkCaught = r != NULL && r != b && r != a;
+    customFree(r);
+    customFree(fence);
+    customFree(guard);
+    char* m = customMTMalloc(300);
+    customMTFree(m + 64);
+    int mtInteriorCaught = !getBlock(m)->free;
+    customMTFree(m);
+    //a foreign pointer while a large block is mapped: the page in front of it is gone
+    void* large = customMalloc(4 * 1024 * 1024);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char* pages = mapChunk(2 * page);
+    munmap(pages, page);
+    customFree(pages + page);
+    customMTFree(pages + page);
+    munmap(pages + page, page);
+    customFree(large);
+    if (interiorCaught && overflowCaught && linkCaught && mtInteriorCaught) {
+        printf(GRN "PASS: Interior pointers, foreign pointers, broken headers and corrupted bin links are caught.\n" RST);
+    } else {
+        printf(RED "FAIL: Hardened free (interior %d/%d, overflow %d, bin link %d).\n" RST,
+               interiorCaught, mtInteriorCaught, overflowCaught, linkCaught);
+    }
+}
+void test_heap_compact() {
+    /*
+       test heap compaction:
+       -zones left without live blocks give their pages back and count as retired
+       -the footprint drops by what compaction reports
+       -later growth brings retired zones back instead of adding zones
+    */
+    printf(YEL "\n--- Test Part B: Heap Compaction ---\n" RST);
+    void* blocks[16];
+    int zonesBefore = num_of_zones;
+    for (int i = 0; i < 16; i++) {
+        blocks[i] = customMTMalloc(3000);
+        memset(blocks[i], 0x6b, 3000);
+    }
+    int zonesGrown = num_of_zones;
+    for (int i = 0; i < 16; i++) {
+        customMTFree(blocks[i]);
+    }
+    size_t footprint = customHeapFootprint();
+    size_t released = customMTHeapCompact();
+    heapStats stats;
+    customMTHeapStats(&stats);
+    int retiredOk = released > 0 && customHeapFootprint() == footprint - released && stats.retiredZones > 0;
+    int zeroed = 1;
+    for (int i = 0; i < 16; i++) {
+        char* block = customMTCalloc(3000, 1);
+        zeroed = zeroed && block != NULL && block[0] == 0 && block[2999] == 0;
+        blocks[i] = block;
+    }
+    int revived = num_of_zones == zonesGrown;
+    for (int i = 0; i < 16; i++) {
+        customMTFree(blocks[i]);
+    }
+    if (zonesGrown > zonesBefore && retiredOk && zeroed && revived) {
+        printf(GRN "PASS: Compaction retired empty zones and growth revived them.\n" RST);
+    } else {
+        printf(RED "FAIL: Compaction (released %zu, retired %zu, zones %d -> %d -> %d).\n" RST,
+               released, stats.retiredZones, zonesBefore, zonesGrown, num_of_zones);
+    }
+}
+typedef struct walkProbe{
+    void* wanted[3];
+    bool found[3];
+    int visits;
+    int stopAfter;
+    bool zonesInRange;
+} walkProbe;
+
+static bool probeBlock(const heapBlockInfo* info, void* ctx) {
+    walkProbe* probe = ctx;
+    probe->visits++;
+    for (int i = 0; i < 3; i++) {
+        if (!info->tail && (Block*)info->block + 1 == probe->wanted[i] && !info->free) {
+            probe->found[i] = true;
+        }
+    }
+    if (info->zone != HEAP_WALK_MAPPED && info->zone >= num_of_zones) {
+        probe->zonesInRange = false;
+    }
+    return probe->stopAfter == 0 || probe->visits < probe->stopAfter;
+}
+
+void test_heap_walk() {
+    /*
+       test heap walks and snapshots:
+       -both walks visit allocated blocks, zone indexes stay inside the zone list
+       -a callback returning false stops the walk
+       -a snapshot holds a zone record per zone and a record per walked block
+    */
+    printf(YEL "\n--- Test Part B: Heap Walk and Snapshot ---\n" RST);
+    walkProbe probe = {{customMTMalloc(40), customMTMalloc(400), customMalloc(64)}, {false}, 0, 0, true};
+    customMTHeapWalk(probeBlock, &probe);
+    customHeapWalk(probeBlock, &probe);
+    int walkOk = probe.found[0] && probe.found[1] && probe.found[2] && probe.zonesInRange;
+    walkProbe stopping = {{NULL}, {false}, 0, 1, true};
+    customMTHeapWalk(probeBlock, &stopping);
+    walkProbe counting = {{NULL}, {false}, 0, 0, true};
+    customMTHeapWalk(probeBlock, &counting);
+    FILE* file = tmpfile();
+    heapSnapshotHeader header;
+    heapSnapshotRecord record;
+    int zoneRecords = 0, blockRecords = 0;
+    int snapOk = file != NULL && customHeapSnapshot(file, true) == 0;
+    if (file != NULL) {
+        rewind(file);
+        snapOk = snapOk && fread(&header, sizeof(header), 1, file) == 1 &&
+                 memcmp(header.magic, HEAP_SNAPSHOT_MAGIC, sizeof(header.magic)) == 0;
+        while (snapOk && fread(&record, sizeof(record), 1, file) == 1) {
+            if (record.flags & HEAP_SNAPSHOT_ZONE) {
+                zoneRecords++;
+            }
+            else {
+                blockRecords++;
+            }
+        }
+        fclose(file);
+    }
+    snapOk = snapOk && zoneRecords == (int)header.zones && blockRecords == counting.visits;
+    customMTFree(probe.wanted[0]);
+    customMTFree(probe.wanted[1]);
+    customFree(probe.wanted[2]);
+    if (walkOk && stopping.visits == 1 && snapOk) {
+        printf(GRN "PASS: Heap walks see every block and snapshots match them.\n" RST);
+    } else {
+        printf(RED "FAIL: Heap walk or snapshot missed blocks (walk %d, stop %d, snapshot %d).\n" RST,
+               walkOk, stopping.visits, snapOk);
+    }
+}
+void test_copy_kernels() {
+    /*
+       test the copy and zero kernels at every level the CPU has:
+       -misaligned heads and tails, short moves and streamed ones
+       -bytes around the destination stay untouched
+    */
+    printf(YEL "\n--- Test: Copy and Zero Kernels ---\n" RST);
+    static const size_t sizes[] = {0, 7, 255, 256, 1000, 4099, KERNEL_STREAM_BYTES + 333};
+    size_t span = KERNEL_STREAM_BYTES + 512;
+    unsigned char* src = customMTMalloc(span);
+    unsigned char* dst = customMTMalloc(span);
+    kernelLevel best = customKernelLevel();
+    int ok = src != NULL && dst != NULL;
+    for (int i = 0; ok && (size_t)i < span; i++) {
+        src[i] = (unsigned char)(i * 31 + 7);
+    }
+    for (int level = KERNEL_SCALAR; ok && level <= (int)best; level++) {
+        ok = customSetKernelLevel((kernelLevel)level) == 0;
+        for (size_t k = 0; ok && k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+            size_t n = sizes[k];
+            size_t offset = 1 + k * 5 % 31;
+            memset(dst, 0xee, span);
+            blockCopy(dst + offset, src + 3, n);
+            ok = memcmp(dst + offset, src + 3, n) == 0 && dst[offset - 1] == 0xee && dst[offset + n] == 0xee;
+            blockZero(dst + offset, n);
+            for (size_t j = 0; ok && j < n; j++) {
+                ok = dst[offset + j] == 0;
+            }
+            ok = ok && dst[offset - 1] == 0xee && dst[offset + n] == 0xee;
+        }
+    }
+    customSetKernelLevel(best);
+    ok = ok && customSetKernelLevel(KERNEL_LEVELS) == -1;
+    customMTFree(src);
+    customMTFree(dst);
+    if (ok) {
+        printf(GRN "PASS: Copy and zero kernels match memcpy and memset up to level %d.\n" RST, (int)best);
+    } else {
+        printf(RED "FAIL: A copy or zero kernel wrote the wrong bytes.\n" RST);
+    }
+}
 void test_combined_lifecycle() {
     /*
        Test part A and part B simultaneously (customMalloc, customMTMalloc, customFree, customMTFree)
@@ -513,14 +1518,38 @@ int main() {
     test_part_a_coalescing();
     test_best_fit();
     test_comb();
+    test_best_fit_large();
     test_calloc_large();
     test_realloc_null_and_zero();
     test_realloc_expansion();
     test_realloc_shrink_split();
     test_realloc_variations_A();
+    test_mt_single_thread_fast_path();
     test_mt_calloc_threaded();
     test_mt_realloc_threaded();
+    test_mt_realloc_in_place();
     test_mt_zone_overflow();
+    test_mt_cache_aligned();
+    test_mt_per_cpu_cache();
+    test_arena();
+    test_pool();
+    test_sized_free();
+    test_mt_batch();
+    test_mt_zone_selection();
+    test_mt_bump_tail();
+    test_mt_deferred_free();
+    test_thread_churn();
+    test_mt_lifetime_hints();
+    test_heap_config();
+    test_memory_budget();
+    test_huge_pages();
+    test_heap_stats();
+    test_heap_compact();
+    test_fast_bins();
+    test_hardened_free();
+    test_heap_walk();
+    test_usable_size();
+    test_copy_kernels();
     test_combined_lifecycle();
     heapKill();
     return 0;